@@ -0,0 +1,331 @@
+// actor decorator: lock-free sharing of a stateful object
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// actor(obj) moves an object into a mailbox owned by one worker thread and
+// hands back a copyable handle. Calls decorated with mailbox(...) do not run
+// on the caller: they are enqueued in the actor's MPSC queue and executed
+// one at a time by the owner, with the result delivered through a
+// std::future. The object is only ever touched by a single thread, so it
+// needs no locks and its data stays in that thread's cache.
+//
+//   auto stand = actor(apples(1.09));
+//   constexpr auto get_cost = mailbox(classmethod(&apples::calculate_cost));
+//   std::future<double> cost = get_cost(stand, 2, 1.1);
+//
+//   g++ -std=c++17 -O2 -pthread actor.cpp
+
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <tuple>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+using namespace std;
+
+//////////////////////////////////////
+//   MPSC mailbox                   //
+//////////////////////////////////////
+
+struct message {
+    virtual ~message() = default;
+    virtual void run() { }
+
+    std::atomic<message*> next{ nullptr };
+};
+
+// Vyukov's intrusive MPSC queue: producers swing `head` with one exchange,
+// the single consumer follows `next` links from `tail`. The last node
+// popped stays behind as the new stub.
+class mpsc_mailbox {
+public:
+    mpsc_mailbox() : head(new message()), tail(head.load()) { }
+
+    // pop() frees each previous stub, which leaves only the last one
+    ~mpsc_mailbox() {
+        while(pop()) { }
+        delete tail;
+    }
+
+    void push(message* m) {
+        m->next.store(nullptr, std::memory_order_relaxed);
+        message* prev = head.exchange(m, std::memory_order_acq_rel);
+        prev->next.store(m, std::memory_order_release);
+    }
+
+    // consumer only. The returned node becomes the stub, so the caller
+    // runs it and must not delete it; the previous stub is freed here.
+    message* pop() {
+        message* next = tail->next.load(std::memory_order_acquire);
+        if(!next) return nullptr;
+
+        delete tail;
+        tail = next;
+        return next;
+    }
+
+    bool empty() const {
+        return tail->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    alignas(64) std::atomic<message*> head;
+    alignas(64) message* tail;
+};
+
+//////////////////////////////////////
+//   actors                         //
+//////////////////////////////////////
+
+template<typename T>
+class actor_state {
+public:
+    explicit actor_state(T obj) : object(std::move(obj)), owner([this]() { loop(); }) { }
+
+    ~actor_state() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        owner.join();
+    }
+
+    void post(message* m) {
+        mailbox.push(m);
+
+        // push then check `sleeping`, while the owner sets `sleeping` then
+        // checks the mailbox: without a full fence on both sides, each can
+        // miss the other's store and the message waits forever
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(sleeping.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            wake.notify_one();
+        }
+    }
+
+    T object;
+
+private:
+    void loop() {
+        for(;;) {
+            // give producers a moment before paying for a sleep and a wake up
+            for(int idle = 0; idle < 64; ++idle) {
+                while(message* m = mailbox.pop()) {
+                    m->run();
+                    idle = 0;
+                }
+                std::this_thread::yield();
+            }
+
+            sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !mailbox.empty(); });
+                if(stopping && mailbox.empty()) return;
+            }
+            sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    mpsc_mailbox mailbox;
+    std::atomic<bool> sleeping{ false };
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread owner;
+};
+
+// copyable handle, shareable across threads
+template<typename T>
+struct actor_handle {
+    std::shared_ptr<actor_state<T>> state;
+};
+
+template<typename T>
+actor_handle<T> actor(T obj) {
+    return actor_handle<T>{ std::make_shared<actor_state<T>>(std::move(obj)) };
+}
+
+template<typename F, typename R>
+struct call_message : message {
+    explicit call_message(F f) : f(std::move(f)) { }
+
+    void run() override {
+        try {
+            if constexpr(std::is_void<R>::value) {
+                f();
+                result.set_value();
+            } else {
+                result.set_value(f());
+            }
+        } catch(...) {
+            result.set_exception(std::current_exception());
+        }
+    }
+
+    F f;
+    std::promise<R> result;
+};
+
+////////////////////////////////////
+//    visitor function            //
+////////////////////////////////////
+
+template<typename F>
+constexpr auto classmethod(F func) {
+    return [func](auto& a, auto&&... args) {
+        return (a.*func)(args...);
+    };
+}
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+// runs visitor(object, args...) on the actor's thread. Arguments are
+// copied into the message since the caller does not wait for the call.
+template<typename F>
+constexpr auto mailbox(const F& visitor) {
+    return [visitor](auto& handle, auto&&... args) {
+        using T = decltype(handle.state->object);
+        using R = decltype(visitor(std::declval<T&>(), args...));
+
+        auto* state = handle.state.get();
+        auto call = [visitor, state, params = std::make_tuple(std::decay_t<decltype(args)>(args)...)]() mutable {
+            return std::apply([&](auto&... p) { return visitor(state->object, p...); }, params);
+        };
+
+        auto* m = new call_message<decltype(call), R>(std::move(call));
+        std::future<R> result = m->result.get_future();
+        state->post(m);
+        return result;
+    };
+}
+
+// the lock-based alternative for the benchmark
+template<typename F>
+constexpr auto locked(const F& visitor) {
+    return [visitor](auto& guarded, auto&&... args) {
+        std::lock_guard<std::mutex> lock(guarded.mutex);
+        return visitor(guarded.object, std::forward<decltype(args)>(args)...);
+    };
+}
+
+template<typename T>
+struct mutex_guarded {
+    explicit mutex_guarded(T obj) : object(std::move(obj)) { }
+
+    T object;
+    std::mutex mutex;
+};
+
+///////////////////////////////////////////////
+// an example class with member functions    //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    // stateful: records a sale and returns the running total
+    double sell(int count) {
+        sold += count;
+        revenue += count*cost_per_apple;
+        return revenue;
+    }
+
+    double cost_per_apple;
+    long sold = 0;
+    double revenue = 0;
+};
+
+////////////////////////////////////
+// final decorated functions      //
+////////////////////////////////////
+
+constexpr auto get_cost = mailbox(classmethod(&apples::calculate_cost));
+constexpr auto sell = mailbox(classmethod(&apples::sell));
+constexpr auto sell_locked = locked(classmethod(&apples::sell));
+
+int main() {
+    auto stand = actor(apples(1.09));
+
+    std::future<double> good = get_cost(stand, 2, 1.1);
+    std::future<double> bad = get_cost(stand, 4, 0);
+
+    std::cout << "Bag cost $" << good.get() << std::endl;
+    try {
+        bad.get();
+    } catch(std::exception& e) {
+        std::cout << "There was an error: " << e.what() << "\n" << std::endl;
+    }
+
+    // producers pipeline their calls and collect the futures at the end
+    auto bench_actor = [](std::size_t threads, int per_thread) {
+        auto shared = actor(apples(1.09));
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> producers;
+        for(std::size_t t = 0; t < threads; ++t) {
+            producers.emplace_back([&shared, per_thread]() {
+                std::vector<std::future<double>> results;
+                results.reserve(per_thread);
+                for(int i = 0; i < per_thread; ++i) {
+                    results.push_back(sell(shared, 1));
+                }
+                for(auto& r : results) r.get();
+            });
+        }
+        for(auto& p : producers) p.join();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        long sold = mailbox([](apples& a) { return a.sold; })(shared).get();
+        std::cout << "actor  " << threads << " producers: " << threads * per_thread / seconds / 1e6 << " Mcalls/s"
+                  << (sold == long(threads * per_thread) ? "" : "  LOST CALLS!") << std::endl;
+    };
+
+    auto bench_mutex = [](std::size_t threads, int per_thread) {
+        mutex_guarded<apples> shared(apples(1.09));
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> producers;
+        for(std::size_t t = 0; t < threads; ++t) {
+            producers.emplace_back([&shared, per_thread]() {
+                for(int i = 0; i < per_thread; ++i) {
+                    sell_locked(shared, 1);
+                }
+            });
+        }
+        for(auto& p : producers) p.join();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "mutex  " << threads << " producers: " << threads * per_thread / seconds / 1e6 << " Mcalls/s" << std::endl;
+    };
+
+    std::size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    for(std::size_t threads = 1; threads <= std::max<std::size_t>(hw, 4); threads *= 2) {
+        bench_mutex(threads, 200000);
+        bench_actor(threads, 200000);
+    }
+
+    return 0;
+}
@@ -0,0 +1,442 @@
+// compares two benchmark runs with significance tests
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// Reads two Google Benchmark style JSON files (for example error_bench.cpp
+// --json, or any benchmark built with --benchmark_format=json and
+// --benchmark_repetitions), matches benchmarks by name and, for each one:
+//
+//   * runs a two-sided Mann-Whitney U test on the repetitions,
+//   * bootstraps a confidence interval for the change in the median,
+//   * flags a REGRESSION when the change is significant and larger than
+//     --threshold, and IMPROVED for the same in the other direction,
+//   * marks a side as noisy when its coefficient of variation exceeds
+//     --max-cv, because a noisy run can hide or fake a regression.
+//
+// It also warns when the recorded context suggests unstable clocks: CPU
+// frequency scaling enabled, or a different CPU frequency between the runs.
+// The exit status is 1 when a regression was found, so CI can gate on it.
+//
+//   g++ -std=c++17 -O2 bench_compare.cpp -o bench_compare
+//   ./bench_compare old.json new.json [--metric cpu_time] [--threshold 0.05]
+//       [--alpha 0.05] [--max-cv 0.05] [--resamples 2000] [--seed 1]
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+//////////////////////////////////////
+//   a tiny JSON reader             //
+//////////////////////////////////////
+
+struct json {
+    enum kind_t { null, boolean, number, string, array, object } kind = null;
+
+    bool flag = false;
+    double num = 0;
+    std::string str;
+    std::vector<std::string> keys;  // objects only, parallel to items
+    std::vector<json> items;        // array elements or object values
+
+    const json* find(const std::string& key) const {
+        for(std::size_t i = 0; i < keys.size(); ++i) {
+            if(keys[i] == key) return &items[i];
+        }
+        return nullptr;
+    }
+
+    std::string text(const std::string& key, const std::string& fallback = "") const {
+        const json* v = find(key);
+        return v && v->kind == string ? v->str : fallback;
+    }
+
+    double value(const std::string& key, double fallback = 0) const {
+        const json* v = find(key);
+        return v && v->kind == number ? v->num : fallback;
+    }
+};
+
+class json_parser {
+public:
+    explicit json_parser(const std::string& text) : text(text) { }
+
+    json parse() {
+        json v = parse_value();
+        skip_space();
+        if(pos != text.size()) fail("trailing characters");
+        return v;
+    }
+
+private:
+    [[noreturn]] void fail(const std::string& what) {
+        throw std::runtime_error("JSON error at offset " + std::to_string(pos) + ": " + what);
+    }
+
+    void skip_space() {
+        while(pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) ++pos;
+    }
+
+    bool consume(char c) {
+        skip_space();
+        if(pos < text.size() && text[pos] == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if(!consume(c)) fail(std::string("expected '") + c + "'");
+    }
+
+    bool consume_word(const char* word) {
+        std::size_t n = std::char_traits<char>::length(word);
+        if(text.compare(pos, n, word) == 0) {
+            pos += n;
+            return true;
+        }
+        return false;
+    }
+
+    json parse_value() {
+        skip_space();
+        if(pos == text.size()) fail("unexpected end");
+
+        json v;
+        char c = text[pos];
+
+        if(c == '{') {
+            v.kind = json::object;
+            ++pos;
+            if(consume('}')) return v;
+            do {
+                skip_space();
+                v.keys.push_back(parse_string());
+                expect(':');
+                v.items.push_back(parse_value());
+            } while(consume(','));
+            expect('}');
+        } else if(c == '[') {
+            v.kind = json::array;
+            ++pos;
+            if(consume(']')) return v;
+            do {
+                v.items.push_back(parse_value());
+            } while(consume(','));
+            expect(']');
+        } else if(c == '"') {
+            v.kind = json::string;
+            v.str = parse_string();
+        } else if(consume_word("true")) {
+            v.kind = json::boolean;
+            v.flag = true;
+        } else if(consume_word("false")) {
+            v.kind = json::boolean;
+        } else if(consume_word("null")) {
+            v.kind = json::null;
+        } else {
+            v.kind = json::number;
+            const char* start = text.c_str() + pos;
+            char* end = nullptr;
+            v.num = std::strtod(start, &end);
+            if(end == start) fail("unexpected character");
+            pos += std::size_t(end - start);
+        }
+
+        return v;
+    }
+
+    // benchmark names are ASCII; \u escapes outside ASCII become '?'
+    std::string parse_string() {
+        if(pos >= text.size() || text[pos] != '"') fail("expected string");
+        ++pos;
+
+        std::string out;
+        while(pos < text.size() && text[pos] != '"') {
+            char c = text[pos++];
+            if(c != '\\') {
+                out += c;
+                continue;
+            }
+
+            if(pos == text.size()) fail("unterminated escape");
+            char e = text[pos++];
+            switch(e) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u': {
+                    if(pos + 4 > text.size()) fail("bad \\u escape");
+                    unsigned code = std::stoul(text.substr(pos, 4), nullptr, 16);
+                    out += code < 0x80 ? char(code) : '?';
+                    pos += 4;
+                    break;
+                }
+                default: out += e;
+            }
+        }
+
+        if(pos == text.size()) fail("unterminated string");
+        ++pos;
+        return out;
+    }
+
+    const std::string& text;
+    std::size_t pos = 0;
+};
+
+//////////////////////////////////////
+//   benchmark runs                 //
+//////////////////////////////////////
+
+struct benchmark_run {
+    json context;
+    std::vector<std::string> order;                      // first-seen order
+    std::map<std::string, std::vector<double>> samples;  // nanoseconds
+};
+
+inline double to_ns(double t, const std::string& unit) {
+    if(unit == "us") return t * 1e3;
+    if(unit == "ms") return t * 1e6;
+    if(unit == "s") return t * 1e9;
+    return t;
+}
+
+inline benchmark_run load_run(const std::string& path, const std::string& metric) {
+    std::ifstream in(path);
+    if(!in) throw std::runtime_error("cannot open " + path);
+
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string text = buffer.str();
+    json root = json_parser(text).parse();
+
+    benchmark_run run;
+    if(const json* context = root.find("context")) run.context = *context;
+
+    const json* benchmarks = root.find("benchmarks");
+    if(!benchmarks || benchmarks->kind != json::array) {
+        throw std::runtime_error(path + " has no \"benchmarks\" array");
+    }
+
+    for(const json& b : benchmarks->items) {
+        // mean/median/stddev rows are summaries of the iterations we read
+        if(b.text("run_type", "iteration") != "iteration") continue;
+
+        std::string name = b.text("run_name", b.text("name"));
+        if(name.empty() || !b.find(metric)) continue;
+
+        if(!run.samples.count(name)) run.order.push_back(name);
+        run.samples[name].push_back(to_ns(b.value(metric), b.text("time_unit", "ns")));
+    }
+
+    return run;
+}
+
+//////////////////////////////////////
+//   statistics                     //
+//////////////////////////////////////
+
+inline double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    std::size_t n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+inline double coefficient_of_variation(const std::vector<double>& v) {
+    if(v.size() < 2) return 0;
+    double mean = std::accumulate(v.begin(), v.end(), 0.0) / v.size();
+    double sq = 0;
+    for(double x : v) sq += (x - mean) * (x - mean);
+    return mean > 0 ? std::sqrt(sq / (v.size() - 1)) / mean : 0;
+}
+
+// two-sided p-value, normal approximation with tie correction
+inline double mann_whitney_p(const std::vector<double>& a, const std::vector<double>& b) {
+    std::vector<std::pair<double, int>> all;
+    for(double x : a) all.emplace_back(x, 0);
+    for(double x : b) all.emplace_back(x, 1);
+    std::sort(all.begin(), all.end());
+
+    double n1 = double(a.size()), n2 = double(b.size()), n = n1 + n2;
+    double rank_sum_a = 0, tie_term = 0;
+
+    for(std::size_t i = 0; i < all.size(); ) {
+        std::size_t j = i;
+        while(j < all.size() && all[j].first == all[i].first) ++j;
+
+        double rank = (double(i) + double(j) + 1) / 2;  // average of ranks i+1..j
+        double ties = double(j - i);
+        tie_term += ties * ties * ties - ties;
+
+        for(std::size_t k = i; k < j; ++k) {
+            if(all[k].second == 0) rank_sum_a += rank;
+        }
+        i = j;
+    }
+
+    double u = rank_sum_a - n1 * (n1 + 1) / 2;
+    double mean_u = n1 * n2 / 2;
+    double var_u = n1 * n2 / 12 * ((n + 1) - tie_term / (n * (n - 1)));
+    if(var_u <= 0) return 1;
+
+    double z = (std::fabs(u - mean_u) - 0.5) / std::sqrt(var_u);
+    return std::erfc(std::max(z, 0.0) / std::sqrt(2.0));
+}
+
+// 95% interval for median(new) / median(old) - 1
+inline std::pair<double, double> bootstrap_change(const std::vector<double>& before, const std::vector<double>& after,
+                                                  int resamples, std::mt19937_64& rng) {
+    std::vector<double> changes;
+    changes.reserve(resamples);
+    std::vector<double> a(before.size()), b(after.size());
+    std::uniform_int_distribution<std::size_t> pick_a(0, before.size() - 1), pick_b(0, after.size() - 1);
+
+    for(int r = 0; r < resamples; ++r) {
+        for(auto& x : a) x = before[pick_a(rng)];
+        for(auto& x : b) x = after[pick_b(rng)];
+        changes.push_back(median(b) / median(a) - 1);
+    }
+
+    std::sort(changes.begin(), changes.end());
+    return { changes[std::size_t(0.025 * (resamples - 1))], changes[std::size_t(0.975 * (resamples - 1))] };
+}
+
+//////////////////////////////////////
+//   environment checks             //
+//////////////////////////////////////
+
+inline void warn_about_context(const json& before, const json& after) {
+    for(const json* c : { &before, &after }) {
+        const json* scaling = c->find("cpu_scaling_enabled");
+        if(scaling && scaling->kind == json::boolean && scaling->flag) {
+            std::cout << "warning: CPU frequency scaling was enabled, timings may be noisy\n";
+            break;
+        }
+    }
+
+    double mhz_before = before.value("mhz_per_cpu"), mhz_after = after.value("mhz_per_cpu");
+    if(mhz_before > 0 && mhz_after > 0 && std::fabs(mhz_after / mhz_before - 1) > 0.05) {
+        std::cout << "warning: CPU frequency differs between runs (" << mhz_before << " vs "
+                  << mhz_after << " MHz)\n";
+    }
+
+    std::string build_before = before.text("library_build_type"), build_after = after.text("library_build_type");
+    if(build_before == "debug" || build_after == "debug") {
+        std::cout << "warning: a run was built in debug mode\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> files;
+    std::string metric = "real_time";
+    double threshold = 0.05, alpha = 0.05, max_cv = 0.05;
+    int resamples = 2000;
+    unsigned long long seed = 1;
+
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if(arg == "--metric" && has_value) metric = argv[++i];
+        else if(arg == "--threshold" && has_value) threshold = std::stod(argv[++i]);
+        else if(arg == "--alpha" && has_value) alpha = std::stod(argv[++i]);
+        else if(arg == "--max-cv" && has_value) max_cv = std::stod(argv[++i]);
+        else if(arg == "--resamples" && has_value) resamples = std::max(100, std::stoi(argv[++i]));
+        else if(arg == "--seed" && has_value) seed = std::stoull(argv[++i]);
+        else files.push_back(arg);
+    }
+
+    if(files.size() != 2) {
+        std::cerr << "usage: " << argv[0] << " old.json new.json [--metric real_time|cpu_time] [--threshold 0.05]"
+                  << " [--alpha 0.05] [--max-cv 0.05] [--resamples 2000] [--seed 1]" << std::endl;
+        return 2;
+    }
+
+    benchmark_run before, after;
+    try {
+        before = load_run(files[0], metric);
+        after = load_run(files[1], metric);
+    } catch(std::exception& e) {
+        std::cerr << "There was an error: " << e.what() << std::endl;
+        return 2;
+    }
+
+    warn_about_context(before.context, after.context);
+
+    std::mt19937_64 rng(seed);
+    int regressions = 0, improvements = 0, noisy = 0;
+
+    std::cout << std::left << std::setw(44) << "benchmark" << std::right
+              << std::setw(12) << "old ns" << std::setw(12) << "new ns" << std::setw(9) << "change"
+              << std::setw(20) << "95% CI" << std::setw(9) << "p" << "  verdict\n";
+
+    for(const std::string& name : before.order) {
+        auto found = after.samples.find(name);
+        if(found == after.samples.end()) continue;
+
+        const std::vector<double>& a = before.samples[name];
+        const std::vector<double>& b = found->second;
+
+        double change = median(b) / median(a) - 1;
+        std::ostringstream interval, p_text;
+        std::string verdict;
+
+        if(a.size() < 2 || b.size() < 2) {
+            interval << "n/a";
+            p_text << "n/a";
+            verdict = "need repetitions";
+        } else {
+            auto ci = bootstrap_change(a, b, resamples, rng);
+            double p = mann_whitney_p(a, b);
+
+            interval << std::showpos << std::fixed << std::setprecision(1)
+                     << "[" << ci.first * 100 << "%, " << ci.second * 100 << "%]";
+            p_text << std::setprecision(3) << p;
+
+            bool significant = p < alpha;
+            if(significant && change > threshold) {
+                verdict = "REGRESSION";
+                ++regressions;
+            } else if(significant && change < -threshold) {
+                verdict = "IMPROVED";
+                ++improvements;
+            } else {
+                verdict = "same";
+            }
+
+            double cv = std::max(coefficient_of_variation(a), coefficient_of_variation(b));
+            if(cv > max_cv) {
+                std::ostringstream note;
+                note << std::fixed << std::setprecision(0) << " (noisy, cv " << cv * 100 << "%)";
+                verdict += note.str();
+                ++noisy;
+            }
+        }
+
+        std::ostringstream change_text;
+        change_text << std::showpos << std::fixed << std::setprecision(1) << change * 100 << "%";
+
+        std::cout << std::left << std::setw(44) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << median(a) << std::setw(12) << median(b) << std::setw(9) << change_text.str()
+                  << std::setw(20) << interval.str() << std::setw(9) << p_text.str() << "  " << verdict << "\n";
+    }
+
+    std::cout << std::defaultfloat << "\n" << regressions << " regressions, " << improvements << " improvements, "
+              << noisy << " noisy benchmarks (threshold " << threshold * 100 << "%, alpha " << alpha << ")" << std::endl;
+
+    return regressions ? 1 : 0;
+}
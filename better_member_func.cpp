@@ -35,7 +35,7 @@ struct optional_type {
 
 // exception decorator for optional return types
 template<typename F>
-auto exception_fail_safe(const F& func)  {
+constexpr auto exception_fail_safe(const F& func)  {
     return [func](auto&&... args) 
     -> optional_type<decltype(func(std::forward<decltype(args)>(args)...))> {
         using R = optional_type<decltype(func(std::forward<decltype(args)>(args)...))>;
@@ -55,7 +55,7 @@ auto exception_fail_safe(const F& func)  {
 
 // this decorator can output our optional data
 template<typename F>
-auto output(const F& func) {
+constexpr auto output(const F& func) {
     return [func](auto&&... args) {
         auto opt = func(std::forward<decltype(args)>(args)...);
         
@@ -73,7 +73,7 @@ auto output(const F& func) {
 // returning is purely conditional based on our needs, in this case
 // we want to take advantage of the functional-like syntax we've created
 template<typename F>
-auto log_time(const F& func) {
+constexpr auto log_time(const F& func) {
     return [func](auto&&... args) {
         auto now = std::chrono::system_clock::now();
         std::time_t time = std::chrono::system_clock::to_time_t(now); 
@@ -110,7 +110,7 @@ struct apples {
 ////////////////////////////////////
 
 template<typename F>
-auto visit_apples(const F& func) {
+constexpr auto visit_apples(const F& func) {
     return [func](apples& a, auto&&... args) {
         return (a.*func)(std::forward<decltype(args)>(args)...);
     };
@@ -120,7 +120,7 @@ auto visit_apples(const F& func) {
 // final decorated function       //
 ////////////////////////////////////
 
-auto get_cost = log_time(output(exception_fail_safe(visit_apples(&apples::calculate_cost))));
+constexpr auto get_cost = log_time(output(exception_fail_safe(visit_apples(&apples::calculate_cost))));
 
 int main() {
     // Different prices for different apples
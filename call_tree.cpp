@@ -0,0 +1,350 @@
+// calling-context tree profiler for nested decorated calls
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// log_time prints a flat total for each decorated function. Once decorated
+// functions call each other, those totals overlap: the outer call's time
+// already includes the inner ones. profiled(name, func) instead records each
+// call under the path of decorated calls that led to it, e.g.
+// checkout;bag_cost;tax. For every path it keeps the call count, the total
+// time and the self time (total minus time spent in decorated children).
+//
+// Each thread grows its own tree. The shadow stack is a thread-local pointer
+// to the node of the innermost active call; each frame restores its parent
+// on the way out. Only the owning thread writes a tree. Nodes are linked
+// with release stores and counters are atomics written by a single thread
+// (no read-modify-write), so merge_profiles() can walk every thread's tree
+// while they are still running. The merged tree prints as an indented
+// report or as folded stacks for flamegraph.pl / speedscope.
+//
+//   g++ -std=c++17 -O2 -pthread call_tree.cpp
+//   ./a.out --folded > calls.folded && flamegraph.pl calls.folded > calls.svg
+
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <map>
+#include <memory>
+#include <string>
+#include <cstring>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+#include <cstdint>
+
+using namespace std;
+
+inline std::uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//////////////////////////////////////
+//   per-thread call trees          //
+//////////////////////////////////////
+
+struct cct_node {
+    explicit cct_node(const char* name, cct_node* parent) : name(name), parent(parent) { }
+
+    ~cct_node() {
+        cct_node* child = first_child.load(std::memory_order_relaxed);
+        while(child) {
+            cct_node* next = child->next_sibling.load(std::memory_order_relaxed);
+            delete child;
+            child = next;
+        }
+    }
+
+    // owner thread only
+    cct_node* child(const char* child_name) {
+        cct_node* first = first_child.load(std::memory_order_relaxed);
+        for(cct_node* c = first; c; c = c->next_sibling.load(std::memory_order_relaxed)) {
+            if(c->name == child_name || std::strcmp(c->name, child_name) == 0) return c;
+        }
+
+        cct_node* fresh = new cct_node(child_name, this);
+        fresh->next_sibling.store(first, std::memory_order_relaxed);
+        first_child.store(fresh, std::memory_order_release);
+        return fresh;
+    }
+
+    // single writer, so a plain load and store is enough
+    static void add(std::atomic<std::uint64_t>& counter, std::uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    const char* name;
+    cct_node* parent;
+    std::atomic<cct_node*> first_child{ nullptr };
+    std::atomic<cct_node*> next_sibling{ nullptr };
+
+    std::atomic<std::uint64_t> calls{ 0 };
+    std::atomic<std::uint64_t> total_ns{ 0 };
+    std::atomic<std::uint64_t> child_ns{ 0 };
+};
+
+// trees outlive their threads so merges still see finished work
+struct profile_registry {
+    static profile_registry& instance() {
+        static profile_registry registry;
+        return registry;
+    }
+
+    cct_node* add_thread() {
+        std::lock_guard<std::mutex> lock(mutex);
+        roots.push_back(std::make_unique<cct_node>("all", nullptr));
+        return roots.back().get();
+    }
+
+    template<typename Visit>
+    void for_each_root(Visit visit) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto& r : roots) visit(*r);
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<cct_node>> roots;
+};
+
+// top of this thread's shadow stack
+inline cct_node*& current_call() {
+    thread_local cct_node* current = profile_registry::instance().add_thread();
+    return current;
+}
+
+//////////////////////////////////////
+//   merging and export             //
+//////////////////////////////////////
+
+struct merged_node {
+    std::uint64_t calls = 0;
+    std::uint64_t total_ns = 0;
+    std::uint64_t self_ns = 0;
+    std::map<std::string, merged_node> children;
+};
+
+inline void merge_into(merged_node& into, const cct_node& from) {
+    for(const cct_node* c = from.first_child.load(std::memory_order_acquire); c;
+        c = c->next_sibling.load(std::memory_order_acquire)) {
+        merged_node& m = into.children[c->name];
+
+        std::uint64_t total = c->total_ns.load(std::memory_order_relaxed);
+        std::uint64_t children = c->child_ns.load(std::memory_order_relaxed);
+
+        m.calls += c->calls.load(std::memory_order_relaxed);
+        m.total_ns += total;
+        // a child can finish between the two loads; never go negative
+        m.self_ns += total > children ? total - children : 0;
+
+        merge_into(m, *c);
+    }
+}
+
+inline merged_node merge_profiles() {
+    merged_node root;
+    profile_registry::instance().for_each_root([&](const cct_node& r) { merge_into(root, r); });
+
+    for(auto& child : root.children) {
+        root.total_ns += child.second.total_ns;
+    }
+    return root;
+}
+
+// one "a;b;c self_microseconds" line per path
+inline void print_folded(std::ostream& os, const merged_node& node, const std::string& path = "") {
+    for(auto& child : node.children) {
+        std::string here = path.empty() ? child.first : path + ";" + child.first;
+        if(child.second.self_ns >= 1000) {
+            os << here << " " << child.second.self_ns / 1000 << "\n";
+        }
+        print_folded(os, child.second, here);
+    }
+}
+
+inline void print_tree(std::ostream& os, const merged_node& node, int depth = 0) {
+    for(auto& child : node.children) {
+        const merged_node& m = child.second;
+        os << std::string(depth * 2, ' ') << child.first
+           << "  calls " << m.calls
+           << "  total " << m.total_ns / 1e6 << "ms"
+           << "  self " << m.self_ns / 1e6 << "ms\n";
+        print_tree(os, m, depth + 1);
+    }
+}
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+template<typename F>
+constexpr auto profiled(const char* name, const F& func) {
+    return [name, func](auto&&... args) -> decltype(auto) {
+        struct frame {
+            cct_node* parent;
+            cct_node* node;
+            std::uint64_t start;
+
+            ~frame() {
+                std::uint64_t elapsed = now_ns() - start;
+                cct_node::add(node->calls, 1);
+                cct_node::add(node->total_ns, elapsed);
+                cct_node::add(parent->child_ns, elapsed);
+                current_call() = parent;
+            }
+        };
+
+        cct_node*& current = current_call();
+        frame f{ current, current->child(name), 0 };
+        current = f.node;
+        f.start = now_ns();
+
+        return func(std::forward<decltype(args)>(args)...);
+    };
+}
+
+// the flat alternative, for comparison
+std::map<std::string, std::uint64_t> flat_totals;
+std::mutex flat_mutex;
+
+template<typename F>
+constexpr auto log_time(const char* name, const F& func) {
+    return [name, func](auto&&... args) -> decltype(auto) {
+        struct stamp {
+            const char* name;
+            std::uint64_t start = now_ns();
+            ~stamp() {
+                std::lock_guard<std::mutex> lock(flat_mutex);
+                flat_totals[name] += now_ns() - start;
+            }
+        } s{ name };
+
+        return func(std::forward<decltype(args)>(args)...);
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    double cost_per_apple;
+};
+
+//////////////////////////////
+// function implementations //
+//////////////////////////////
+
+// stand-in for real work so the times are visible
+double spin(int rounds, double x) {
+    for(int i = 0; i < rounds; ++i) {
+        x = x * 1.0000001 + 0.0000001;
+    }
+    return x;
+}
+
+double tax_impl(double amount) {
+    return spin(2000, amount) * 0.0 + amount * 1.07;
+}
+
+double discount_impl(int count, double amount) {
+    return spin(500, amount) * 0.0 + (count >= 10 ? amount * 0.9 : amount);
+}
+
+template<typename Tax, typename Discount>
+auto make_bag_cost(Tax tax, Discount discount) {
+    return [tax, discount](apples& a, int count, double weight) {
+        return tax(discount(count, a.calculate_cost(count, weight)));
+    };
+}
+
+template<typename BagCost, typename Tax>
+auto make_checkout(BagCost bag_cost, Tax tax) {
+    return [bag_cost, tax](apples& a, int bags) {
+        double total = 0;
+        for(int i = 1; i <= bags; ++i) {
+            total += bag_cost(a, i, 1.1);
+        }
+        // a delivery fee is taxed on its own, outside bag_cost
+        return total + tax(spin(3000, 5.0) * 0.0 + 5.0);
+    };
+}
+
+///////////////////////////////
+// final decorated functions //
+///////////////////////////////
+
+const auto tax = profiled("tax", tax_impl);
+const auto discount = profiled("discount", discount_impl);
+const auto bag_cost = profiled("bag_cost", make_bag_cost(tax, discount));
+const auto checkout = profiled("checkout", make_checkout(bag_cost, tax));
+
+const auto flat_tax = log_time("tax", tax_impl);
+const auto flat_discount = log_time("discount", discount_impl);
+const auto flat_bag_cost = log_time("bag_cost", make_bag_cost(flat_tax, flat_discount));
+const auto flat_checkout = log_time("checkout", make_checkout(flat_bag_cost, flat_tax));
+
+int main(int argc, char** argv) {
+    bool folded = argc > 1 && std::string(argv[1]) == "--folded";
+
+    std::vector<std::thread> cashiers;
+    for(int t = 0; t < 2; ++t) {
+        cashiers.emplace_back([]() {
+            apples groceries(1.09);
+            for(int i = 0; i < 200; ++i) {
+                checkout(groceries, 12);
+                flat_checkout(groceries, 12);
+            }
+        });
+    }
+    for(auto& c : cashiers) c.join();
+
+    merged_node profile = merge_profiles();
+
+    if(folded) {
+        print_folded(std::cout, profile);
+        return 0;
+    }
+
+    std::cout << "flat log_time totals (nested calls are counted once per enclosing call):\n";
+    std::uint64_t flat_sum = 0;
+    for(auto& t : flat_totals) {
+        std::cout << "  " << t.first << " " << t.second / 1e6 << "ms\n";
+        flat_sum += t.second;
+    }
+    std::cout << "  sum " << flat_sum / 1e6 << "ms\n\n";
+
+    std::cout << "calling-context tree (" << profile.total_ns / 1e6 << "ms in decorated calls):\n";
+    print_tree(std::cout, profile);
+
+    std::cout << "\nfolded stacks (self microseconds):\n";
+    print_folded(std::cout, profile);
+
+    // cost of the decorator itself
+    const auto empty = profiled("empty", [](int x) { return x; });
+    const int calls = 1000000;
+    int sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < calls; ++i) {
+        sum += empty(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "\nprofiled overhead: " << std::chrono::duration<double, std::nano>(end - start).count() / calls
+              << " ns/call (checksum " << sum << ")" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,279 @@
+// closure size and layout report for decorator chains
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// Every decorator captures the function it wraps by value, so a chain is one
+// object whose size is the sum of every layer's captures plus padding. That is
+// usually a pointer or two, until one layer captures a std::string or a
+// std::function and the whole chain stops fitting the small buffer of
+// std::function, a task queue slot or a cache line.
+//
+// A lambda's captures cannot be inspected, so the decorators here wrap their
+// lambda in layer<Name, Inner, Closure>. It derives from the lambda (same size,
+// same call operator) and records the wrapped type and the decorator's name.
+// chain_layout<T> walks those records at compile time:
+//
+//   chain_layout<T>::layers   one entry per layer, outermost first: name,
+//                             size, alignment and the bytes the layer adds
+//                             on top of what it wraps
+//   fits_inline<chain, N>     true when the chain fits an N byte inline
+//                             buffer: size, alignment and a noexcept move
+//
+// so a layout regression fails the build:
+//
+//   static_assert(fits_inline<get_cost, 32>, "get_cost no longer fits 32 bytes");
+//
+//   g++ -std=c++17 -O2 closure_layout.cpp
+
+#include <iostream>
+#include <iomanip>
+#include <array>
+#include <atomic>
+#include <string>
+#include <chrono>
+#include <ctime>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+using namespace std;
+
+////////////////////////////////////
+//      optional type             //
+////////////////////////////////////
+template<typename T>
+struct optional_type {
+    T value;
+    bool OK;
+    bool BAD;
+    std::string msg;
+
+    optional_type(T&& t) : value(std::move(t)) { OK = true; BAD = false; }
+    optional_type(bool ok, std::string msg="") : msg(std::move(msg)) { OK = ok; BAD = !ok; }
+};
+
+//////////////////////////////////////
+//   layer records                  //
+//////////////////////////////////////
+
+// a decorator's lambda, tagged with the decorator's name and the type it wraps
+template<const char* Name, typename Inner, typename Closure>
+struct layer : Closure {
+    using inner_type = Inner;
+    static constexpr const char* name = Name;
+
+    constexpr explicit layer(Closure c) : Closure(std::move(c)) { }
+    using Closure::operator();
+};
+
+// a plain function is captured as a function pointer, so record it as one
+template<const char* Name, typename Inner, typename Closure>
+constexpr auto make_layer(const Inner&, Closure c) {
+    return layer<Name, std::decay_t<Inner>, Closure>(std::move(c));
+}
+
+struct layer_layout {
+    const char* name;
+    std::size_t size;
+    std::size_t align;
+    std::size_t own;    // bytes this layer adds to what it wraps, padding included
+};
+
+template<typename T>
+constexpr const char* leaf_name() {
+    if constexpr(std::is_member_function_pointer_v<T>) return "member function pointer";
+    else if constexpr(std::is_pointer_v<T>) return "function pointer";
+    else return "callable";
+}
+
+// undecorated leaf
+template<typename T, typename = void>
+struct chain_layout {
+    static constexpr std::size_t depth = 1;
+    static constexpr std::array<layer_layout, 1> layers{ { { leaf_name<T>(), sizeof(T), alignof(T), sizeof(T) } } };
+};
+
+template<typename T>
+struct chain_layout<T, std::void_t<typename T::inner_type>> {
+    using inner = chain_layout<typename T::inner_type>;
+    static constexpr std::size_t depth = inner::depth + 1;
+
+    static constexpr std::array<layer_layout, depth> build() {
+        std::array<layer_layout, depth> out{};
+        out[0] = layer_layout{ T::name, sizeof(T), alignof(T), sizeof(T) - sizeof(typename T::inner_type) };
+        for(std::size_t i = 1; i < depth; ++i) out[i] = inner::layers[i - 1];
+        return out;
+    }
+
+    static constexpr std::array<layer_layout, depth> layers = build();
+};
+
+template<typename T, std::size_t N>
+inline constexpr bool closure_fits_inline = sizeof(T) <= N
+    && alignof(T) <= alignof(std::max_align_t)
+    && std::is_nothrow_move_constructible_v<T>;
+
+// takes the decorated global itself: fits_inline<get_cost, 32>
+template<const auto& Chain, std::size_t N>
+inline constexpr bool fits_inline = closure_fits_inline<std::decay_t<decltype(Chain)>, N>;
+
+template<typename T>
+void print_layout(const T&, const char* label) {
+    using layout = chain_layout<T>;
+
+    std::cout << label << ": " << sizeof(T) << " bytes, align " << alignof(T) << "\n";
+    for(std::size_t i = 0; i < layout::depth; ++i) {
+        const layer_layout& l = layout::layers[i];
+        std::cout << "  " << std::string(i * 2, ' ') << std::left << std::setw(36 - int(i) * 2) << l.name
+                  << std::right << std::setw(5) << l.size << " bytes" << std::setw(6) << "+" + std::to_string(l.own)
+                  << "  align " << l.align << "\n";
+    }
+    std::cout << std::endl;
+}
+
+/////////////////////////////////////
+//          decorators             //
+/////////////////////////////////////
+
+inline constexpr char exception_fail_safe_name[] = "exception_fail_safe";
+inline constexpr char output_name[] = "output";
+inline constexpr char log_time_name[] = "log_time";
+inline constexpr char count_calls_name[] = "count_calls";
+inline constexpr char labelled_log_name[] = "labelled_log (std::string)";
+inline constexpr char visit_apples_name[] = "visit_apples";
+
+template<typename F>
+constexpr auto exception_fail_safe(const F& func)  {
+    return make_layer<exception_fail_safe_name>(func, [func](auto&&... args)
+    -> optional_type<decltype(func(std::forward<decltype(args)>(args)...))> {
+        using R = optional_type<decltype(func(std::forward<decltype(args)>(args)...))>;
+
+        try {
+            return R(func(std::forward<decltype(args)>(args)...));
+        } catch(std::iostream::failure& e) {
+            return R(false, e.what());
+        } catch(std::exception& e) {
+            return R(false, e.what());
+        } catch(...) {
+            // This ... catch clause will capture any exception thrown
+            return R(false, std::string("Exception caught: default exception"));
+        }
+    });
+}
+
+template<typename F>
+constexpr auto output(const F& func) {
+    return make_layer<output_name>(func, [func](auto&&... args) {
+        auto opt = func(std::forward<decltype(args)>(args)...);
+
+        if(opt.BAD) {
+            std::cout << "There was an error: " << opt.msg << std::endl;
+        } else {
+            std::cout << "Bag cost $" << opt.value << std::endl;
+        }
+
+        return opt;
+    });
+}
+
+template<typename F>
+constexpr auto log_time(const F& func) {
+    return make_layer<log_time_name>(func, [func](auto&&... args) {
+        auto now = std::chrono::system_clock::now();
+        std::time_t time = std::chrono::system_clock::to_time_t(now);
+        auto opt = func(std::forward<decltype(args)>(args)...);
+        std::cout << "> Logged at " << std::ctime(&time) << std::endl;
+
+        return opt;
+    });
+}
+
+// stateful, but only the address of the counter is captured (see constinit.cpp)
+template<typename F>
+constexpr auto count_calls(std::atomic<std::uint64_t>& calls, const F& func) {
+    return make_layer<count_calls_name>(func, [func, calls = &calls](auto&&... args) {
+        calls->fetch_add(1, std::memory_order_relaxed);
+        return func(std::forward<decltype(args)>(args)...);
+    });
+}
+
+// owns its label: a std::string in every copy of the chain
+template<typename F>
+auto labelled_log(std::string label, const F& func) {
+    return make_layer<labelled_log_name>(func, [func, label = std::move(label)](auto&&... args) {
+        auto opt = func(std::forward<decltype(args)>(args)...);
+        std::cout << "> " << label << " returned" << std::endl;
+
+        return opt;
+    });
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    double cost_per_apple;
+};
+
+////////////////////////////////////
+//    visitor function            //
+////////////////////////////////////
+
+template<typename F>
+constexpr auto visit_apples(const F& func) {
+    return make_layer<visit_apples_name>(func, [func](apples& a, auto&&... args) {
+        return (a.*func)(std::forward<decltype(args)>(args)...);
+    });
+}
+
+///////////////////////////////
+// final decorated functions //
+///////////////////////////////
+
+std::atomic<std::uint64_t> cost_calls{ 0 };
+
+constexpr auto get_cost = log_time(output(exception_fail_safe(visit_apples(&apples::calculate_cost))));
+constexpr auto counted_cost = log_time(output(count_calls(cost_calls, exception_fail_safe(visit_apples(&apples::calculate_cost)))));
+double plain_cost(apples& a, int count, double weight) { return a.calculate_cost(count, weight); }
+
+constexpr auto safe_plain_cost = exception_fail_safe(plain_cost);
+const auto labelled_cost = output(labelled_log("get_cost", exception_fail_safe(visit_apples(&apples::calculate_cost))));
+
+// the layout budgets; changing a decorator's captures breaks these at compile time
+static_assert(fits_inline<get_cost, 16>, "get_cost no longer fits 16 bytes");
+static_assert(fits_inline<counted_cost, 32>, "counted_cost no longer fits 32 bytes");
+static_assert(!fits_inline<labelled_cost, 32>, "labelled_cost is expected to exceed 32 bytes");
+static_assert(chain_layout<decltype(get_cost)>::depth == 5);
+static_assert(chain_layout<decltype(safe_plain_cost)>::layers[1].size == sizeof(void*));
+
+int main() {
+    print_layout(get_cost, "get_cost");
+    print_layout(counted_cost, "counted_cost");
+    print_layout(labelled_cost, "labelled_cost");
+    print_layout(safe_plain_cost, "safe_plain_cost");
+
+    // the layers are still the same callables
+    apples groceries(1.09);
+    get_cost(groceries, 2, 1.1);
+    counted_cost(groceries, 0, 1.1);
+    labelled_cost(groceries, 3, 1.1);
+
+    std::cout << "counted_cost was called " << cost_calls << " time(s)" << std::endl;
+
+    return 0;
+}
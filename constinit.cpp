@@ -0,0 +1,299 @@
+// decorated globals without dynamic initialization
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// Stateless decorators are constexpr so `constexpr auto get_cost = ...` is
+// built by the compiler (see example.cpp). Stateful decorators such as call
+// counters and caches cannot carry a std::map or a std::shared_ptr through a
+// constant expression, so their state lives in a constinit object declared
+// next to the decorated global. The decorator only stores that object's
+// address. Heavy state (e.g. a cache's map) is constructed on first call and
+// is never destroyed, so there is no static-init or static-destruction order
+// to get wrong.
+//
+// Startup benchmark: this file also declares thousands of decorated globals.
+//   g++ -std=c++20 -O2 constinit.cpp -o constinit
+//   g++ -std=c++20 -O2 -DDYNAMIC_GLOBALS constinit.cpp -o dynamic_globals
+//   ./constinit && ./dynamic_globals
+
+#include <iostream>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <string>
+#include <chrono>
+#include <ctime>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <cstdint>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+//////////////////////////////////////
+//   lazily attached storage        //
+//////////////////////////////////////
+
+// constant-initialized slot for state that is not a literal type.
+// T is built on first access and deliberately leaked.
+template<typename T>
+class lazy {
+public:
+    constexpr lazy() = default;
+    lazy(const lazy&) = delete;
+    lazy& operator=(const lazy&) = delete;
+
+    T& get() {
+        if(state.load(std::memory_order_acquire) != ready) {
+            construct();
+        }
+
+        return *std::launder(reinterpret_cast<T*>(storage));
+    }
+
+    bool attached() const { return state.load(std::memory_order_acquire) == ready; }
+
+private:
+    enum : int { empty, building, ready };
+
+    // if T() throws, the slot goes back to empty and the next caller retries
+    void construct() {
+        for(;;) {
+            int expected = empty;
+            if(state.compare_exchange_strong(expected, building, std::memory_order_acquire)) {
+                try {
+                    ::new(static_cast<void*>(storage)) T();
+                } catch(...) {
+                    state.store(empty, std::memory_order_release);
+                    throw;
+                }
+                state.store(ready, std::memory_order_release);
+                return;
+            }
+
+            while(expected == building) {
+                std::this_thread::yield();
+                expected = state.load(std::memory_order_acquire);
+            }
+            if(expected == ready) return;
+        }
+    }
+
+    alignas(T) unsigned char storage[sizeof(T)]{};
+    std::atomic<int> state{ empty };
+};
+
+// counters are literal types already, no laziness needed
+struct call_stats {
+    std::atomic<std::uint64_t> calls{ 0 };
+    std::atomic<std::uint64_t> failures{ 0 };
+};
+
+template<typename Signature>
+struct memo_cache;
+
+// the map is shared by every caller, so it is only touched under the mutex.
+// The wrapped function runs unlocked; two threads may both compute a miss.
+template<typename R, typename... Args>
+struct memo_cache<R(Args...)> {
+    std::mutex mutex;
+    std::map<std::tuple<std::decay_t<Args>...>, R> values;
+};
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+template<typename F>
+constexpr auto log_time(const F& func) {
+    return [func](auto&&... args) {
+        auto now = std::chrono::system_clock::now();
+        std::time_t time = std::chrono::system_clock::to_time_t(now);
+        auto result = func(std::forward<decltype(args)>(args)...);
+        std::cout << "> Logged at " << std::ctime(&time) << std::endl;
+
+        return result;
+    };
+}
+
+// stateful: counts calls and exceptions into `stats`
+template<typename F>
+constexpr auto count_calls(call_stats& stats, const F& func) {
+    return [func, stats = &stats](auto&&... args) {
+        stats->calls.fetch_add(1, std::memory_order_relaxed);
+
+        try {
+            return func(std::forward<decltype(args)>(args)...);
+        } catch(...) {
+            stats->failures.fetch_add(1, std::memory_order_relaxed);
+            throw;
+        }
+    };
+}
+
+// stateful: the map inside `cache` is created by the first call
+template<typename R, typename... Args, typename F>
+constexpr auto memoize(lazy<memo_cache<R(Args...)>>& cache, const F& func) {
+    return [func, cache = &cache](const Args&... args) -> R {
+        auto& memo = cache->get();
+        auto key = std::make_tuple(args...);
+
+        {
+            std::lock_guard<std::mutex> lock(memo.mutex);
+            auto it = memo.values.find(key);
+            if(it != memo.values.end()) {
+                return it->second;
+            }
+        }
+
+        R result = func(args...);
+        std::lock_guard<std::mutex> lock(memo.mutex);
+        memo.values.emplace(std::move(key), result);
+        return result;
+    };
+}
+
+// the same two stateful decorators the usual way, owning their state
+namespace dynamic {
+    template<typename F>
+    auto count_calls(const F& func) {
+        auto stats = std::make_shared<call_stats>();
+        return [func, stats](auto&&... args) {
+            stats->calls.fetch_add(1, std::memory_order_relaxed);
+            return func(std::forward<decltype(args)>(args)...);
+        };
+    }
+
+    template<typename F>
+    auto memoize(const F& func) {
+        auto cache = std::make_shared<memo_cache<double(int, double)>>();
+        return [func, cache](int count, double weight) {
+            auto key = std::make_tuple(count, weight);
+            {
+                std::lock_guard<std::mutex> lock(cache->mutex);
+                auto it = cache->values.find(key);
+                if(it != cache->values.end()) {
+                    return it->second;
+                }
+            }
+
+            double result = func(count, weight);
+            std::lock_guard<std::mutex> lock(cache->mutex);
+            cache->values.emplace(key, result);
+            return result;
+        };
+    }
+}
+
+//////////////////////////////
+// function implementations //
+//////////////////////////////
+
+double price_impl(int count, double weight) {
+    if(count <= 0)
+        throw std::runtime_error("must have 1 or more apples");
+
+    return count * weight * 1.09;
+}
+
+///////////////////////////////
+// final decorated functions //
+///////////////////////////////
+
+constinit call_stats price_stats;
+constinit lazy<memo_cache<double(int, double)>> price_cache;
+
+constexpr auto price = log_time(count_calls(price_stats, memoize(price_cache, price_impl)));
+
+//////////////////////////////////////
+//   thousands of decorated globals //
+//////////////////////////////////////
+
+#define DECORATE_2(m, p)    m(p##0) m(p##1)
+#define DECORATE_4(m, p)    DECORATE_2(m, p##0) DECORATE_2(m, p##1)
+#define DECORATE_8(m, p)    DECORATE_4(m, p##0) DECORATE_4(m, p##1)
+#define DECORATE_16(m, p)   DECORATE_8(m, p##0) DECORATE_8(m, p##1)
+#define DECORATE_32(m, p)   DECORATE_16(m, p##0) DECORATE_16(m, p##1)
+#define DECORATE_64(m, p)   DECORATE_32(m, p##0) DECORATE_32(m, p##1)
+#define DECORATE_128(m, p)  DECORATE_64(m, p##0) DECORATE_64(m, p##1)
+#define DECORATE_256(m, p)  DECORATE_128(m, p##0) DECORATE_128(m, p##1)
+#define DECORATE_512(m, p)  DECORATE_256(m, p##0) DECORATE_256(m, p##1)
+#define DECORATE_1024(m, p) DECORATE_512(m, p##0) DECORATE_512(m, p##1)
+#define DECORATE_4096(m, p) DECORATE_1024(m, p##0) DECORATE_1024(m, p##1) DECORATE_1024(m, p##2) DECORATE_1024(m, p##3)
+
+#ifdef DYNAMIC_GLOBALS
+    #define DECORATED_GLOBAL(name) \
+        auto name = dynamic::count_calls(dynamic::memoize(price_impl));
+#else
+    #define DECORATED_GLOBAL(name) \
+        constinit call_stats name##_stats; \
+        constinit lazy<memo_cache<double(int, double)>> name##_cache; \
+        constexpr auto name = count_calls(name##_stats, memoize(name##_cache, price_impl));
+#endif
+
+// stamps taken by dynamic initialization before and after the globals
+// below; in the constinit build nothing runs in between
+const auto init_start = std::chrono::steady_clock::now();
+DECORATE_4096(DECORATED_GLOBAL, price_)
+const auto init_end = std::chrono::steady_clock::now();
+
+// exec this binary repeatedly so the whole startup is measured,
+// including relocation and the dynamic initializers above
+// re-runs this binary; /proc/self/exe still finds it when argv[0] came from PATH
+double average_startup_us(const char* self, int runs) {
+    auto start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < runs; ++i) {
+        pid_t pid = fork();
+        if(pid == 0) {
+            execl("/proc/self/exe", self, "--exit", static_cast<char*>(nullptr));
+            execl(self, self, "--exit", static_cast<char*>(nullptr));
+            _exit(127);
+        }
+
+        int status = 0;
+        waitpid(pid, &status, 0);
+    }
+
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / runs;
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1 && std::string(argv[1]) == "--exit") {
+        return 0;
+    }
+
+#ifdef DYNAMIC_GLOBALS
+    const char* mode = "dynamic";
+#else
+    const char* mode = "constinit";
+#endif
+
+    std::cout << "price cache attached before first call: " << price_cache.attached() << std::endl;
+    price(4, 1.1);
+    price(4, 1.1);
+    std::cout << "price cache attached after first call: " << price_cache.attached() << std::endl;
+
+    try {
+        price(0, 1.1);
+    } catch(std::exception& e) {
+        std::cout << "error: " << e.what() << std::endl;
+    }
+
+    std::cout << "calls " << price_stats.calls << ", failures " << price_stats.failures << "\n" << std::endl;
+
+    // touch one of the generated globals so none of them is dead code
+    std::cout << "price_00000000000(2, 1.5) = " << price_00000000000(2, 1.5) << "\n" << std::endl;
+
+    std::cout << "[" << mode << "] 4096 decorated globals" << std::endl;
+    std::cout << "  dynamic initialization: "
+              << std::chrono::duration<double, std::micro>(init_end - init_start).count() << " us" << std::endl;
+    std::cout << "  fork+exec+exit:         " << average_startup_us(argv[0], 200) << " us" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,248 @@
+// on-CPU vs off-CPU breakdown for decorated calls
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// log_time says a call took 20ms, but not why. cpu_breakdown(func, name)
+// reads the thread's CPU clock (CLOCK_THREAD_CPUTIME_ID) next to the
+// monotonic clock around every call. Wall time minus CPU time is time the
+// thread spent off the CPU: blocked in I/O or a lock, sleeping, or ready to
+// run but descheduled.
+//
+// With count_switches set, it also reads getrusage(RUSAGE_THREAD) before and
+// after the call to tell those cases apart. Voluntary context switches mean
+// the call blocked; involuntary ones mean the scheduler took the CPU away.
+// That costs two extra syscalls per call, so it is off by default.
+//
+// Totals are kept per decorated function and printed by print_breakdowns()
+// with a hint: CPU-bound calls are candidates for parallelism, blocked ones
+// for removing the blocking, descheduled ones for fewer threads.
+//
+//   g++ -std=c++17 -O2 -pthread cpu_breakdown.cpp
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <map>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+#include <cstdint>
+#include <time.h>
+#include <sys/resource.h>
+
+using namespace std;
+
+//////////////////////////////////////
+//   clocks                         //
+//////////////////////////////////////
+
+inline std::uint64_t clock_ns(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return std::uint64_t(ts.tv_sec) * 1000000000u + std::uint64_t(ts.tv_nsec);
+}
+
+struct switch_counts {
+    std::uint64_t voluntary = 0;
+    std::uint64_t involuntary = 0;
+};
+
+inline switch_counts thread_switches() {
+#if defined(RUSAGE_THREAD)
+    rusage usage;
+    if(getrusage(RUSAGE_THREAD, &usage) == 0) {
+        return switch_counts{ std::uint64_t(usage.ru_nvcsw), std::uint64_t(usage.ru_nivcsw) };
+    }
+#endif
+    // not available on this platform: report no switches
+    return switch_counts{};
+}
+
+//////////////////////////////////////
+//   per-function totals            //
+//////////////////////////////////////
+
+struct cpu_totals {
+    std::atomic<std::uint64_t> calls{ 0 };
+    std::atomic<std::uint64_t> wall_ns{ 0 };
+    std::atomic<std::uint64_t> cpu_ns{ 0 };
+    std::atomic<std::uint64_t> voluntary{ 0 };
+    std::atomic<std::uint64_t> involuntary{ 0 };
+};
+
+struct breakdown_registry {
+    static breakdown_registry& instance() {
+        static breakdown_registry registry;
+        return registry;
+    }
+
+    // the same name always gets the same totals
+    cpu_totals* totals_for(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& slot = totals[name];
+        if(!slot) slot = std::make_unique<cpu_totals>();
+        return slot.get();
+    }
+
+    template<typename Visit>
+    void for_each(Visit visit) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto& t : totals) visit(t.first, *t.second);
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::string, std::unique_ptr<cpu_totals>> totals;
+};
+
+inline void print_breakdowns(std::ostream& os) {
+    os << std::left << std::setw(16) << "function" << std::right
+       << std::setw(8) << "calls" << std::setw(12) << "wall ms" << std::setw(12) << "cpu ms"
+       << std::setw(8) << "on-cpu" << std::setw(10) << "vol/call" << std::setw(12) << "invol/call"
+       << "  hint\n";
+
+    breakdown_registry::instance().for_each([&](const std::string& name, const cpu_totals& t) {
+        double calls = double(std::max<std::uint64_t>(t.calls, 1));
+        double wall = double(t.wall_ns), cpu = double(t.cpu_ns);
+        double on_cpu = wall > 0 ? std::min(cpu / wall, 1.0) : 0;
+        double voluntary = double(t.voluntary) / calls;
+        double involuntary = double(t.involuntary) / calls;
+
+        const char* hint = "cpu-bound: parallelize or optimize";
+        if(on_cpu < 0.8) {
+            if(voluntary > involuntary) {
+                hint = "blocked: remove or overlap the waiting";
+            } else if(involuntary > 0) {
+                hint = "descheduled: too many runnable threads";
+            } else {
+                hint = "off-cpu: enable count_switches to see why";
+            }
+        }
+
+        os << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(2)
+           << std::setw(8) << t.calls << std::setw(12) << wall / 1e6 << std::setw(12) << cpu / 1e6
+           << std::setw(7) << on_cpu * 100 << "%" << std::setw(10) << voluntary << std::setw(12) << involuntary
+           << "  " << hint << "\n";
+    });
+}
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+template<typename F>
+auto cpu_breakdown(const F& func, const std::string& name = "anonymous", bool count_switches = false) {
+    cpu_totals* totals = breakdown_registry::instance().totals_for(name);
+
+    return [func, totals, count_switches](auto&&... args) -> decltype(auto) {
+        struct sample {
+            cpu_totals* totals;
+            bool count_switches;
+            switch_counts switches = count_switches ? thread_switches() : switch_counts{};
+            std::uint64_t wall = clock_ns(CLOCK_MONOTONIC);
+            std::uint64_t cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+
+            ~sample() {
+                std::uint64_t cpu_end = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+                std::uint64_t wall_end = clock_ns(CLOCK_MONOTONIC);
+
+                totals->calls.fetch_add(1, std::memory_order_relaxed);
+                totals->wall_ns.fetch_add(wall_end - wall, std::memory_order_relaxed);
+                totals->cpu_ns.fetch_add(cpu_end - cpu, std::memory_order_relaxed);
+
+                if(count_switches) {
+                    switch_counts end = thread_switches();
+                    totals->voluntary.fetch_add(end.voluntary - switches.voluntary, std::memory_order_relaxed);
+                    totals->involuntary.fetch_add(end.involuntary - switches.involuntary, std::memory_order_relaxed);
+                }
+            }
+        } s{ totals, count_switches };
+
+        return func(std::forward<decltype(args)>(args)...);
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    double cost_per_apple;
+};
+
+//////////////////////////////
+// function implementations //
+//////////////////////////////
+
+// pure computation
+double price_catalog_impl(apples& a, int entries) {
+    double total = 0;
+    for(int i = 1; i <= entries; ++i) {
+        total += a.calculate_cost(i % 50 + 1, 1.0 + (i % 7) * 0.1);
+    }
+    return total;
+}
+
+// waits on a "supplier" like a network call would
+double fetch_price_impl(apples& a) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    return a.cost_per_apple;
+}
+
+///////////////////////////////
+// final decorated functions //
+///////////////////////////////
+
+const auto price_catalog = cpu_breakdown(price_catalog_impl, "price_catalog", true);
+const auto fetch_price = cpu_breakdown(fetch_price_impl, "fetch_price", true);
+const auto crowded_catalog = cpu_breakdown(price_catalog_impl, "crowded_catalog", true);
+const auto cheap_catalog = cpu_breakdown(price_catalog_impl, "clocks_only");
+
+int main() {
+    apples groceries(1.09);
+    double sum = 0;
+
+    for(int i = 0; i < 20; ++i) {
+        sum += price_catalog(groceries, 2000000);
+        sum += fetch_price(groceries);
+        sum += cheap_catalog(groceries, 200000);
+    }
+
+    // more busy threads than cores: calls are ready to run but wait for a CPU
+    std::size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> crowd;
+    for(std::size_t t = 0; t < hw * 3; ++t) {
+        crowd.emplace_back([]() {
+            apples stand(1.09);
+            double local = 0;
+            for(int i = 0; i < 5; ++i) {
+                local += crowded_catalog(stand, 4000000);
+            }
+            if(local < 0) std::cout << local;
+        });
+    }
+    for(auto& c : crowd) c.join();
+
+    std::cout << "(checksum " << sum << ")\n" << std::endl;
+    print_breakdowns(std::cout);
+
+    return 0;
+}
@@ -0,0 +1,318 @@
+// error-path benchmark: exceptions vs error codes through decorator layers
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// practical.cpp and better_member_func.cpp report failures by throwing through
+// the decorator chain to exception_fail_safe. This measures what that costs
+// as the chain gets deeper, as failures get more common, and as more threads
+// fail at once (unwinding can contend on shared locks). It compares against
+// an error-code chain that returns the failure by value through the same
+// layers.
+//
+// Each layer is an out-of-line call with a destructor to run, like a real
+// decorator holding a guard, so the unwinder has one frame per layer to
+// process. Both chains end in the same optional_type, including the same
+// message string.
+//
+// The table shows CPU time per call, which stays honest when there are more
+// threads than cores. --json prints Google Benchmark style JSON
+// with --repetitions runs of each case; bench_compare.cpp compares two of them.
+//
+//   g++ -std=c++17 -O2 -pthread error_bench.cpp
+//   ./a.out --json --repetitions 5 > errors.json
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+#include <time.h>
+
+using namespace std;
+
+////////////////////////////////////
+//      optional type             //
+////////////////////////////////////
+template<typename T>
+struct optional_type {
+    T value;
+    bool OK;
+    bool BAD;
+    std::string msg;
+
+    optional_type(T&& t) : value(std::move(t)) { OK = true; BAD = false; }
+    optional_type(bool ok, std::string msg="") : msg(std::move(msg)) { OK = ok; BAD = !ok; }
+};
+
+// the error-code alternative: a value or a static message
+struct cost_result {
+    double value;
+    const char* error;
+};
+
+/////////////////////////////////////
+//          decorators             //
+/////////////////////////////////////
+
+thread_local int live_frames = 0;
+
+// one decorator layer: a real frame with cleanup work during unwinding
+template<typename F>
+constexpr auto layer(const F& func) {
+    return [func](auto&&... args) __attribute__((noinline)) -> decltype(auto) {
+        struct frame_guard {
+            frame_guard() { ++live_frames; }
+            ~frame_guard() { --live_frames; }
+        } guard;
+
+        return func(std::forward<decltype(args)>(args)...);
+    };
+}
+
+template<std::size_t N, typename F>
+constexpr auto layers(const F& func) {
+    if constexpr(N == 0) {
+        return func;
+    } else {
+        return layer(layers<N - 1>(func));
+    }
+}
+
+template<typename F>
+constexpr auto exception_fail_safe(const F& func)  {
+    return [func](auto&&... args)
+    -> optional_type<decltype(func(std::forward<decltype(args)>(args)...))> {
+        using R = optional_type<decltype(func(std::forward<decltype(args)>(args)...))>;
+
+        try {
+            return R(func(std::forward<decltype(args)>(args)...));
+        } catch(std::iostream::failure& e) {
+            return R(false, e.what());
+        } catch(std::exception& e) {
+            return R(false, e.what());
+        } catch(...) {
+            // This ... catch clause will capture any exception thrown
+            return R(false, std::string("Exception caught: default exception"));
+        }
+    };
+}
+
+// the same conversion for a chain that returns cost_result
+template<typename F>
+constexpr auto error_code_fail_safe(const F& func) {
+    return [func](auto&&... args) -> optional_type<double> {
+        cost_result r = func(std::forward<decltype(args)>(args)...);
+
+        if(r.error) {
+            return optional_type<double>(false, r.error);
+        }
+
+        return optional_type<double>(std::move(r.value));
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    // the same checks, reported by value
+    cost_result try_calculate_cost(int count, double weight) {
+        if(count <= 0)
+            return cost_result{ 0, "must have 1 or more apples" };
+
+        if(weight <= 0)
+            return cost_result{ 0, "apples must weigh more than 0 ounces" };
+
+        return cost_result{ count*weight*cost_per_apple, nullptr };
+    }
+
+    double cost_per_apple;
+};
+
+////////////////////////////////////
+//    visitor function            //
+////////////////////////////////////
+
+template<typename F>
+constexpr auto visit_apples(const F& func) {
+    return [func](apples& a, auto&&... args) {
+        return (a.*func)(std::forward<decltype(args)>(args)...);
+    };
+}
+
+////////////////////////////////////
+//     benchmark                  //
+////////////////////////////////////
+
+inline double thread_cpu_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// per call, averaged over every thread's calls. Wall time includes waiting
+// for a core when threads outnumber cores; CPU time does not.
+struct case_time {
+    double real_ns;
+    double cpu_ns;
+};
+
+template<typename F>
+case_time run_case(const F& get_cost, int error_percent, std::size_t threads, int calls_per_thread) {
+    std::atomic<std::size_t> ready{ 0 };
+    std::atomic<bool> go{ false };
+    std::vector<case_time> elapsed(threads);
+    std::vector<std::thread> workers;
+
+    for(std::size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            apples groceries(1.09);
+            int failures = 0;
+
+            ready.fetch_add(1);
+            while(!go.load()) std::this_thread::yield();
+
+            auto start = std::chrono::steady_clock::now();
+            double cpu_start = thread_cpu_ns();
+            for(int i = 0; i < calls_per_thread; ++i) {
+                // a fixed, evenly spread pattern of failing calls
+                bool fail = int((std::uint32_t(i) * 7919u) % 100u) < error_percent;
+                failures += get_cost(groceries, fail ? 0 : 2, 1.1).BAD;
+            }
+            elapsed[t].cpu_ns = thread_cpu_ns() - cpu_start;
+            elapsed[t].real_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+            if(failures < 0) std::cout << failures;
+        });
+    }
+
+    while(ready.load() != threads) std::this_thread::yield();
+    go = true;
+    for(auto& w : workers) w.join();
+
+    case_time total{ 0, 0 };
+    for(auto& e : elapsed) {
+        total.real_ns += e.real_ns;
+        total.cpu_ns += e.cpu_ns;
+    }
+
+    double calls = double(threads) * calls_per_thread;
+    return case_time{ total.real_ns / calls, total.cpu_ns / calls };
+}
+
+template<std::size_t Depth>
+case_time run_depth(bool exceptions, int error_percent, std::size_t threads, int calls) {
+    constexpr auto throwing = exception_fail_safe(layers<Depth>(visit_apples(&apples::calculate_cost)));
+    constexpr auto returning = error_code_fail_safe(layers<Depth>(visit_apples(&apples::try_calculate_cost)));
+
+    return exceptions ? run_case(throwing, error_percent, threads, calls)
+                      : run_case(returning, error_percent, threads, calls);
+}
+
+case_time run(bool exceptions, std::size_t depth, int error_percent, std::size_t threads, int calls) {
+    switch(depth) {
+        case 1:  return run_depth<1>(exceptions, error_percent, threads, calls);
+        case 2:  return run_depth<2>(exceptions, error_percent, threads, calls);
+        case 4:  return run_depth<4>(exceptions, error_percent, threads, calls);
+        case 8:  return run_depth<8>(exceptions, error_percent, threads, calls);
+        default: return run_depth<16>(exceptions, error_percent, threads, calls);
+    }
+}
+
+int main(int argc, char** argv) {
+    bool json = false;
+    int repetitions = 1;
+    int calls = 20000;
+
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--json") json = true;
+        else if(arg == "--repetitions" && i + 1 < argc) repetitions = std::max(1, std::stoi(argv[++i]));
+        else if(arg == "--calls" && i + 1 < argc) calls = std::max(1, std::stoi(argv[++i]));
+    }
+
+    const std::size_t depths[] = { 1, 2, 4, 8, 16 };
+    const int error_percents[] = { 0, 1, 10, 50, 100 };
+
+    std::vector<std::size_t> thread_counts;
+    std::size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    for(std::size_t t = 1; t <= std::max<std::size_t>(hw, 4); t *= 2) {
+        thread_counts.push_back(t);
+    }
+
+    if(json) {
+        std::ostringstream out;
+        out << "{\n  \"context\": {\"executable\": \"" << argv[0] << "\", \"num_cpus\": " << hw
+            << ", \"library_build_type\": \"release\"},\n  \"benchmarks\": [";
+
+        bool first = true;
+        for(const char* variant : { "exceptions", "error_codes" }) {
+            for(std::size_t depth : depths) {
+                for(int errors : error_percents) {
+                    for(std::size_t threads : thread_counts) {
+                        std::ostringstream name;
+                        name << variant << "/depth:" << depth << "/errors:" << errors << "/threads:" << threads;
+
+                        for(int r = 0; r < repetitions; ++r) {
+                            case_time t = run(std::string(variant) == "exceptions", depth, errors, threads, calls);
+                            out << (first ? "\n" : ",\n") << "    {\"name\": \"" << name.str()
+                                << "\", \"run_name\": \"" << name.str() << "\", \"run_type\": \"iteration\""
+                                << ", \"repetitions\": " << repetitions << ", \"repetition_index\": " << r
+                                << ", \"threads\": " << threads << ", \"iterations\": " << calls
+                                << ", \"real_time\": " << t.real_ns << ", \"cpu_time\": " << t.cpu_ns
+                                << ", \"time_unit\": \"ns\"}";
+                            first = false;
+                        }
+                    }
+                }
+            }
+        }
+
+        out << "\n  ]\n}\n";
+        std::cout << out.str();
+        return 0;
+    }
+
+    std::cout << "CPU ns per call, exceptions / error codes\n\n" << std::setw(7) << "layers" << std::setw(8) << "errors";
+    for(std::size_t threads : thread_counts) {
+        std::cout << std::setw(16) << (std::to_string(threads) + " thread" + (threads > 1 ? "s" : ""));
+    }
+    std::cout << "\n";
+
+    for(std::size_t depth : depths) {
+        for(int errors : error_percents) {
+            std::cout << std::setw(7) << depth << std::setw(7) << errors << "%";
+            for(std::size_t threads : thread_counts) {
+                double thrown = run(true, depth, errors, threads, calls).cpu_ns;
+                double returned = run(false, depth, errors, threads, calls).cpu_ns;
+
+                std::ostringstream cell;
+                cell << std::fixed << std::setprecision(0) << thrown << " / " << returned;
+                std::cout << std::setw(16) << cell.str();
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,468 @@
+// fork-join decorator for divide-and-conquer recursion
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// Builds on recursive.cpp: the implementation receives the decorated function
+// as `self` and splits its work with fork2(left, right). fork_join(grain, func)
+// decides per call whether that split runs in parallel. Above `grain` the right
+// half is pushed onto the worker's deque where idle workers can steal it while
+// the left half runs inline (help-first). At or below `grain` the whole subtree
+// runs serially with no task overhead. A joiner whose task was stolen helps by
+// stealing other work, so stack and deque depth stay bounded by the recursion
+// depth.
+//
+//   g++ -std=c++17 -O2 -pthread fork_join.cpp
+
+#include <iostream>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <iterator>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <chrono>
+#include <random>
+#include <cstdint>
+
+using namespace std;
+
+//////////////////////////////////////
+//   fixpoint (see recursive.cpp)   //
+//////////////////////////////////////
+
+template<typename Impl, typename Decorator>
+struct recursive_fn {
+    struct open {
+        const recursive_fn* self;
+
+        template<typename... Args>
+        decltype(auto) operator()(Args&&... args) const {
+            return self->impl(*self, std::forward<Args>(args)...);
+        }
+    };
+
+    recursive_fn(Impl impl, const Decorator& decorator)
+        : impl(std::move(impl)), decorated(decorator(open{ this })) { }
+
+    // the chain points back at this object, so it must stay put
+    recursive_fn(const recursive_fn&) = delete;
+    recursive_fn& operator=(const recursive_fn&) = delete;
+
+    template<typename... Args>
+    decltype(auto) operator()(Args&&... args) const {
+        return decorated(std::forward<Args>(args)...);
+    }
+
+    Impl impl;
+    decltype(std::declval<const Decorator&>()(std::declval<open>())) decorated;
+};
+
+template<typename Decorator>
+constexpr auto recursive(Decorator decorator) {
+    return [decorator](auto impl) {
+        return recursive_fn<decltype(impl), Decorator>(std::move(impl), decorator);
+    };
+}
+
+//////////////////////////////////////
+//   tasks and deques               //
+//////////////////////////////////////
+
+// tasks live on the stack of the thread that forked them; that thread
+// does not return until `done` is set
+struct task {
+    virtual void run() = 0;
+    std::atomic<bool> done{ false };
+
+protected:
+    ~task() = default;
+};
+
+template<typename F>
+struct task_of final : task {
+    explicit task_of(F& f) : f(f) { }
+
+    void run() override {
+        try {
+            f();
+        } catch(...) {
+            error = std::current_exception();
+        }
+
+        // the owner may free this task as soon as it sees `done`
+        done.store(true, std::memory_order_release);
+    }
+
+    F& f;
+    std::exception_ptr error;
+};
+
+// Chase-Lev work-stealing deque. The owner pushes and pops at the bottom,
+// thieves take from the top. Fixed capacity: a full deque makes the fork run
+// inline instead.
+struct work_deque {
+    static constexpr std::int64_t capacity = 1 << 12;
+
+    bool push(task* t) {
+        std::int64_t b = bottom.load(std::memory_order_relaxed);
+        std::int64_t tp = top.load(std::memory_order_acquire);
+        if(b - tp >= capacity) return false;
+
+        slots[b & (capacity - 1)].store(t, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    task* pop() {
+        std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t tp = top.load(std::memory_order_relaxed);
+
+        if(tp > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        task* t = slots[b & (capacity - 1)].load(std::memory_order_relaxed);
+        if(tp == b) {
+            // last item, race the thieves for it
+            if(!top.compare_exchange_strong(tp, tp + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                t = nullptr;
+            }
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        return t;
+    }
+
+    task* steal() {
+        std::int64_t tp = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t b = bottom.load(std::memory_order_acquire);
+        if(tp >= b) return nullptr;
+
+        task* t = slots[tp & (capacity - 1)].load(std::memory_order_relaxed);
+        if(!top.compare_exchange_strong(tp, tp + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+
+        return t;
+    }
+
+    alignas(64) std::atomic<std::int64_t> top{ 0 };
+    alignas(64) std::atomic<std::int64_t> bottom{ 0 };
+    alignas(64) std::atomic<task*> slots[capacity];
+};
+
+//////////////////////////////////////
+//   worker pool                    //
+//////////////////////////////////////
+
+struct fork_join_pool;
+
+struct worker {
+    work_deque deque;
+    fork_join_pool* pool = nullptr;
+    std::size_t index = 0;
+    std::minstd_rand rng;
+};
+
+thread_local worker* current_worker = nullptr;
+thread_local bool fork_join_serial = false;
+
+struct fork_join_pool {
+    // `threads` includes the caller of run(), which lends itself as worker 0
+    explicit fork_join_pool(std::size_t threads) {
+        threads = std::max<std::size_t>(threads, 1);
+
+        for(std::size_t i = 0; i < threads; ++i) {
+            workers.emplace_back(new worker());
+            workers.back()->pool = this;
+            workers.back()->index = i;
+            workers.back()->rng.seed(unsigned(i + 1));
+        }
+
+        for(std::size_t i = 1; i < threads; ++i) {
+            threads_.emplace_back([this, i]() { work(*workers[i]); });
+        }
+    }
+
+    ~fork_join_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for(auto& t : threads_) {
+            t.join();
+        }
+    }
+
+    template<typename F>
+    decltype(auto) run(F&& f) {
+        if(current_worker && current_worker->pool == this) {
+            return f();
+        }
+
+        // one outside caller at a time drives the pool
+        std::lock_guard<std::mutex> caller(run_mutex);
+
+        struct scope {
+            fork_join_pool& pool;
+            worker* saved;
+
+            scope(fork_join_pool& pool) : pool(pool), saved(current_worker) {
+                current_worker = pool.workers[0].get();
+                {
+                    std::lock_guard<std::mutex> lock(pool.mutex);
+                    pool.active = true;
+                }
+                pool.wake.notify_all();
+            }
+
+            ~scope() {
+                std::lock_guard<std::mutex> lock(pool.mutex);
+                pool.active = false;
+                current_worker = saved;
+            }
+        } enter(*this);
+
+        return f();
+    }
+
+    task* steal_for(worker& thief) {
+        std::size_t n = workers.size();
+        std::size_t start = thief.rng() % n;
+
+        for(std::size_t i = 0; i < n; ++i) {
+            worker& victim = *workers[(start + i) % n];
+            if(&victim == &thief) continue;
+
+            if(task* t = victim.deque.steal()) {
+                return t;
+            }
+        }
+
+        return nullptr;
+    }
+
+    std::size_t size() const { return workers.size(); }
+
+private:
+    void work(worker& self) {
+        current_worker = &self;
+
+        for(;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || active; });
+                if(stopping) return;
+            }
+
+            // spin on steals while a run is in flight
+            while(active_flag()) {
+                if(task* t = steal_for(self)) {
+                    t->run();
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    bool active_flag() const {
+        return active.load(std::memory_order_acquire) && !stopping.load(std::memory_order_relaxed);
+    }
+
+    std::vector<std::unique_ptr<worker>> workers;
+    std::vector<std::thread> threads_;
+    std::mutex run_mutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    // written under `mutex` so sleeping workers cannot miss a wake up,
+    // read without it while spinning
+    std::atomic<bool> active{ false };
+    std::atomic<bool> stopping{ false };
+};
+
+fork_join_pool& default_pool() {
+    static fork_join_pool pool(std::thread::hardware_concurrency());
+    return pool;
+}
+
+// runs left and right, in parallel when the enclosing fork_join call is above
+// its grain. Results are returned through captures.
+template<typename L, typename R>
+void fork2(L&& left, R&& right) {
+    worker* self = current_worker;
+
+    if(!self || fork_join_serial || self->pool->size() == 1) {
+        left();
+        right();
+        return;
+    }
+
+    task_of<std::remove_reference_t<R>> pending(right);
+    if(!self->deque.push(&pending)) {
+        left();
+        right();
+        return;
+    }
+
+    std::exception_ptr left_error;
+    try {
+        left();
+    } catch(...) {
+        left_error = std::current_exception();
+    }
+
+    // everything pushed by left() has been popped again, so if `pending`
+    // was not stolen it is the item at the bottom
+    if(self->deque.pop() == &pending) {
+        pending.run();
+    } else {
+        while(!pending.done.load(std::memory_order_acquire)) {
+            if(task* t = self->pool->steal_for(*self)) {
+                t->run();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    if(left_error) std::rethrow_exception(left_error);
+    if(pending.error) std::rethrow_exception(pending.error);
+}
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+// default problem size: the distance between the first two arguments,
+// e.g. (first, last) or (first, last, scratch)
+struct range_size {
+    template<typename It, typename... Rest>
+    std::size_t operator()(const It& first, const It& last, const Rest&...) const {
+        return std::size_t(std::distance(first, last));
+    }
+};
+
+template<typename F, typename Size = range_size>
+auto fork_join(std::size_t grain, const F& func, Size size = Size()) {
+    return [func, grain, size](auto&&... args) -> decltype(auto) {
+        // the outermost call enters the default pool
+        if(!current_worker) {
+            return default_pool().run([&]() -> decltype(auto) {
+                return func(std::forward<decltype(args)>(args)...);
+            });
+        }
+
+        if(!fork_join_serial && size(args...) <= grain) {
+            struct serial_scope {
+                serial_scope() { fork_join_serial = true; }
+                ~serial_scope() { fork_join_serial = false; }
+            } serial;
+
+            return func(std::forward<decltype(args)>(args)...);
+        }
+
+        return func(std::forward<decltype(args)>(args)...);
+    };
+}
+
+////////////////////////////////////////
+//    function implementations        //
+////////////////////////////////////////
+
+auto sum_impl = [](auto& self, const std::int64_t* first, const std::int64_t* last) -> std::int64_t {
+    if(last - first <= 2048) {
+        return std::accumulate(first, last, std::int64_t(0));
+    }
+
+    auto mid = first + (last - first) / 2;
+    std::int64_t a = 0, b = 0;
+    fork2([&]() { a = self(first, mid); }, [&]() { b = self(mid, last); });
+    return a + b;
+};
+
+auto mergesort_impl = [](auto& self, int* first, int* last, int* scratch) -> void {
+    if(last - first <= 64) {
+        std::sort(first, last);
+        return;
+    }
+
+    auto half = (last - first) / 2;
+    auto mid = first + half;
+    fork2([&]() { self(first, mid, scratch); }, [&]() { self(mid, last, scratch + half); });
+
+    std::merge(first, mid, mid, last, scratch);
+    std::copy(scratch, scratch + (last - first), first);
+};
+
+/////////////////////////////////////////
+// final decorated functions           //
+/////////////////////////////////////////
+
+auto sum = recursive([](auto f) { return fork_join(1 << 16, f); })(sum_impl);
+auto mergesort = recursive([](auto f) { return fork_join(1 << 14, f); })(mergesort_impl);
+
+int main() {
+    const std::size_t n = 1 << 24;
+    std::vector<std::int64_t> numbers(n);
+    std::iota(numbers.begin(), numbers.end(), 0);
+
+    std::vector<int> unsorted(1 << 22);
+    std::mt19937 gen(7);
+    for(auto& v : unsorted) v = int(gen());
+
+    auto time = [](auto&& f) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    // serial baselines
+    std::int64_t expected = 0;
+    double sum_serial = time([&]() { expected = std::accumulate(numbers.begin(), numbers.end(), std::int64_t(0)); });
+
+    auto sorted = unsorted;
+    double sort_serial = time([&]() { std::sort(sorted.begin(), sorted.end()); });
+
+    std::cout << "serial: sum " << sum_serial << " ms, sort " << sort_serial << " ms\n" << std::endl;
+    std::cout << "threads   sum ms   speedup   sort ms   speedup" << std::endl;
+
+    std::size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    for(std::size_t threads = 1; threads <= std::max<std::size_t>(hw, 4); threads *= 2) {
+        fork_join_pool pool(threads);
+
+        std::int64_t total = 0;
+        double sum_ms = time([&]() { total = pool.run([&]() { return sum(numbers.data(), numbers.data() + n); }); });
+
+        auto data = unsorted;
+        std::vector<int> scratch(data.size());
+        double sort_ms = time([&]() {
+            pool.run([&]() { mergesort(data.data(), data.data() + data.size(), scratch.data()); });
+        });
+
+        if(total != expected || data != sorted) {
+            std::cout << "wrong result with " << threads << " threads!" << std::endl;
+            return 1;
+        }
+
+        std::cout << threads << "\t  " << sum_ms << "\t   " << sum_serial / sum_ms
+                  << "\t     " << sort_ms << "\t " << sort_serial / sort_ms << std::endl;
+    }
+
+    // without an explicit pool the outermost call enters the default one
+    std::cout << "\ndefault pool sum = " << sum(numbers.data(), numbers.data() + n) << std::endl;
+
+    return 0;
+}
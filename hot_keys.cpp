@@ -0,0 +1,440 @@
+// hot-key detection for decorated functions
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// track_hot_keys(k, func) counts which argument tuples dominate the calls made
+// through a decorated function. Every thread feeds its own Space-Saving sketch
+// with no locks or shared writes, and every so often folds it into one merged
+// sketch per decorated function. The merged top-k is published through a tiny
+// metrics registry so it can be scraped like any other counter.
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <typeindex>
+#include <functional>
+#include <algorithm>
+#include <type_traits>
+#include <tuple>
+#include <chrono>
+#include <stdexcept>
+#include <cstdint>
+#include <limits>
+
+using namespace std;
+
+//////////////////////////////////////
+//      metrics registry            //
+//////////////////////////////////////
+
+// a sample is one line of a prometheus-like text scrape
+struct metric_sample {
+    std::string name;
+    std::string labels;
+    double value;
+};
+
+// collectors are asked for their samples whenever the registry is scraped
+struct metrics_registry {
+    using collector = std::function<void(std::vector<metric_sample>&)>;
+
+    static metrics_registry& instance() {
+        static metrics_registry registry;
+        return registry;
+    }
+
+    void add_collector(collector c) {
+        std::lock_guard<std::mutex> lock(mutex);
+        collectors.push_back(std::move(c));
+    }
+
+    std::vector<metric_sample> scrape() {
+        std::vector<metric_sample> samples;
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto& c : collectors) {
+            c(samples);
+        }
+        return samples;
+    }
+
+    void print(std::ostream& os) {
+        for(auto& s : scrape()) {
+            os << s.name << "{" << s.labels << "} " << s.value << "\n";
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<collector> collectors;
+};
+
+//////////////////////////////////////
+//   argument keys                  //
+//////////////////////////////////////
+
+// values are tracked by value, everything else (e.g. the apples& passed to a
+// visitor) by identity so we never copy large objects on the hot path
+template<typename T>
+auto key_of(const T& t) -> std::enable_if_t<std::is_arithmetic<T>::value || std::is_enum<T>::value, T> {
+    return t;
+}
+
+template<typename T>
+auto key_of(const T& t) -> std::enable_if_t<std::is_class<T>::value, const T*> {
+    return &t;
+}
+
+// pointers are keyed by address too, except C strings, which are text.
+// Arrays and functions arrive undecayed, so both work on the decayed type.
+template<typename T>
+using is_object_pointer = std::integral_constant<bool, std::is_pointer<std::decay_t<T>>::value
+    && !std::is_function<std::remove_pointer_t<std::decay_t<T>>>::value
+    && !std::is_same<std::remove_cv_t<std::remove_pointer_t<std::decay_t<T>>>, char>::value>;
+
+template<typename T>
+auto key_of(const T& t) -> std::enable_if_t<is_object_pointer<T>::value, const void*> {
+    std::decay_t<const T> p = t;
+    return const_cast<const void*>(static_cast<const volatile void*>(p));
+}
+
+template<typename T>
+auto key_of(const T& t) -> std::enable_if_t<std::is_function<std::remove_pointer_t<std::decay_t<T>>>::value, const void*> {
+    std::decay_t<const T> p = t;
+    return reinterpret_cast<const void*>(p);
+}
+
+inline std::string key_of(const std::string& s) { return s; }
+inline std::string key_of(const char* s) { return std::string(s); }
+
+template<typename T>
+using key_of_t = decltype(key_of(std::declval<const std::decay_t<T>&>()));
+
+inline std::uint64_t mix_hash(std::uint64_t seed, std::uint64_t h) {
+    // boost::hash_combine widened to 64 bits
+    return seed ^ (h + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+
+template<typename Tuple, std::size_t... I>
+std::uint64_t hash_key(const Tuple& key, std::index_sequence<I...>) {
+    std::uint64_t seed = 0;
+    // C++14 friendly fold over the tuple
+    (void)std::initializer_list<int>{
+        (seed = mix_hash(seed, std::hash<std::tuple_element_t<I, Tuple>>()(std::get<I>(key))), 0)...
+    };
+    return seed;
+}
+
+template<typename... Ts>
+std::uint64_t hash_key(const std::tuple<Ts...>& key) {
+    return hash_key(key, std::index_sequence_for<Ts...>());
+}
+
+// prints a key tuple as "(a, b, c)". Doubles get enough digits to read
+// back exactly, since specialize.cpp compares the emitted values with ==.
+template<typename Tuple, std::size_t... I>
+void describe_key(std::ostream& os, const Tuple& key, std::index_sequence<I...>) {
+    os << std::setprecision(std::numeric_limits<double>::max_digits10) << "(";
+    (void)std::initializer_list<int>{
+        (os << (I == 0 ? "" : ", ") << std::get<I>(key), 0)...
+    };
+    os << ")";
+}
+
+template<typename... Ts>
+std::string describe_key(const std::tuple<Ts...>& key) {
+    std::ostringstream ss;
+    describe_key(ss, key, std::index_sequence_for<Ts...>());
+    return ss.str();
+}
+
+//////////////////////////////////////
+//   space-saving sketch            //
+//////////////////////////////////////
+
+// Metwally et al. Space-Saving: `capacity` counters, a miss evicts the
+// smallest counter and inherits its count as the error bound.
+// Keys are compared by hash only; a collision merges two keys' counts.
+template<typename Key>
+struct space_saving {
+    struct counter {
+        std::uint64_t hash;
+        std::uint64_t count;
+        std::uint64_t error;
+        Key key;
+    };
+
+    explicit space_saving(std::size_t capacity) : capacity(capacity) {
+        counters.reserve(capacity);
+    }
+
+    void offer(std::uint64_t hash, const Key& key, std::uint64_t weight = 1, std::uint64_t error = 0) {
+        for(auto& c : counters) {
+            if(c.hash == hash) {
+                c.count += weight;
+                c.error += error;
+                return;
+            }
+        }
+
+        if(counters.size() < capacity) {
+            counters.push_back(counter{ hash, weight, error, key });
+            return;
+        }
+
+        auto min = std::min_element(counters.begin(), counters.end(),
+            [](const counter& a, const counter& b) { return a.count < b.count; });
+
+        *min = counter{ hash, min->count + weight, min->count + error, key };
+    }
+
+    void merge_into(space_saving& other) const {
+        for(auto& c : counters) {
+            other.offer(c.hash, c.key, c.count, c.error);
+        }
+    }
+
+    std::vector<counter> top(std::size_t k) const {
+        auto sorted = counters;
+        std::sort(sorted.begin(), sorted.end(),
+            [](const counter& a, const counter& b) { return a.count > b.count; });
+
+        if(sorted.size() > k) {
+            sorted.resize(k);
+        }
+
+        return sorted;
+    }
+
+    void clear() { counters.clear(); }
+
+    std::size_t capacity;
+    std::vector<counter> counters;
+};
+
+//////////////////////////////////////
+//   per-decorator shared state     //
+//////////////////////////////////////
+
+// a generic lambda may be called with more than one argument signature so
+// the merged sketches are kept per key type
+struct hot_key_table_base {
+    virtual ~hot_key_table_base() = default;
+    virtual void collect(const std::string& name, std::size_t k, std::vector<metric_sample>& out) = 0;
+};
+
+template<typename Key>
+struct hot_key_table : hot_key_table_base {
+    explicit hot_key_table(std::size_t capacity) : merged(capacity) { }
+
+    void collect(const std::string& name, std::size_t k, std::vector<metric_sample>& out) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::size_t rank = 0;
+        for(auto& c : merged.top(k)) {
+            std::string labels = "fn=\"" + name + "\",rank=\"" + std::to_string(rank++)
+                + "\",args=\"" + describe_key(c.key) + "\"";
+            out.push_back(metric_sample{ "hot_key_calls", labels, double(c.count) });
+            out.push_back(metric_sample{ "hot_key_error", labels, double(c.error) });
+        }
+    }
+
+    std::mutex mutex;
+    space_saving<Key> merged;
+};
+
+struct hot_key_state {
+    hot_key_state(std::string name, std::size_t k) : name(std::move(name)), k(k) { }
+
+    template<typename Key>
+    hot_key_table<Key>& table() {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& t = tables[std::type_index(typeid(Key))];
+        if(!t) {
+            t.reset(new hot_key_table<Key>(capacity()));
+        }
+        return static_cast<hot_key_table<Key>&>(*t);
+    }
+
+    void collect(std::vector<metric_sample>& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto& t : tables) {
+            t.second->collect(name, k, out);
+        }
+    }
+
+    // over-provision the counters so the reported top-k is accurate
+    std::size_t capacity() const { return k * 4; }
+
+    std::string name;
+    std::size_t k;
+    std::mutex mutex;
+    std::map<std::type_index, std::unique_ptr<hot_key_table_base>> tables;
+};
+
+//////////////////////////////////////
+//   per-thread sketches            //
+//////////////////////////////////////
+
+// how many calls a thread records before folding its sketch into the merged one
+constexpr std::uint32_t hot_key_flush_interval = 4096;
+
+template<typename Key>
+struct local_hot_keys {
+    local_hot_keys(std::shared_ptr<hot_key_state> owner)
+        : owner(std::move(owner)), table(this->owner->template table<Key>()), sketch(this->owner->capacity()) { }
+
+    ~local_hot_keys() { flush(); }
+
+    void record(const Key& key) {
+        sketch.offer(hash_key(key), key);
+
+        if(++pending == hot_key_flush_interval) {
+            flush();
+        }
+    }
+
+    void flush() {
+        if(pending == 0) return;
+
+        std::lock_guard<std::mutex> lock(table.mutex);
+        sketch.merge_into(table.merged);
+        sketch.clear();
+        pending = 0;
+    }
+
+    std::shared_ptr<hot_key_state> owner;
+    hot_key_table<Key>& table;
+    space_saving<Key> sketch;
+    std::uint32_t pending = 0;
+};
+
+// the last sketch used is cached so the common case is one pointer compare
+template<typename Key>
+local_hot_keys<Key>& local_sketch(const std::shared_ptr<hot_key_state>& state) {
+    thread_local std::unordered_map<const hot_key_state*, std::unique_ptr<local_hot_keys<Key>>> sketches;
+    thread_local local_hot_keys<Key>* last = nullptr;
+
+    if(last && last->owner == state) {
+        return *last;
+    }
+
+    auto& slot = sketches[state.get()];
+    if(!slot) {
+        slot.reset(new local_hot_keys<Key>(state));
+    }
+
+    last = slot.get();
+    return *last;
+}
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+// records the argument tuple of every call and publishes the k hottest ones
+// under the name `name` through metrics_registry
+template<typename F>
+auto track_hot_keys(std::size_t k, const F& func, std::string name = "anonymous") {
+    auto state = std::make_shared<hot_key_state>(std::move(name), k);
+
+    metrics_registry::instance().add_collector([state](std::vector<metric_sample>& out) {
+        state->collect(out);
+    });
+
+    return [func, state](auto&&... args) -> decltype(auto) {
+        using Key = std::tuple<key_of_t<decltype(args)>...>;
+        local_sketch<Key>(state).record(Key(key_of(args)...));
+        return func(std::forward<decltype(args)>(args)...);
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    double cost_per_apple;
+};
+
+////////////////////////////////////
+//    visitor function            //
+////////////////////////////////////
+
+template<typename F>
+auto visit_apples(const F& func) {
+    return [func](apples& a, auto&&... args) {
+        return (a.*func)(std::forward<decltype(args)>(args)...);
+    };
+}
+
+////////////////////////////////////
+// final decorated function       //
+////////////////////////////////////
+
+auto get_cost = track_hot_keys(3, visit_apples(&apples::calculate_cost), "get_cost");
+
+int main() {
+    apples groceries(1.09);
+
+    // most bags weigh 1.1 ounces, a handful of other weights show up rarely
+    auto shop = [&groceries](unsigned seed, int calls) {
+        double sum = 0;
+        for(int i = 0; i < calls; ++i) {
+            seed = seed * 1664525u + 1013904223u;
+            double weight = (seed >> 24) < 200 ? 1.1 : 0.5 + (seed >> 28) * 0.25;
+            int count = (seed >> 16) % 4 == 0 ? 2 : 5;
+            sum += get_cost(groceries, count, weight);
+        }
+        return sum;
+    };
+
+    // each worker keeps its own sketch and folds it in when it exits
+    std::vector<std::thread> workers;
+    for(unsigned t = 0; t < 4; ++t) {
+        workers.emplace_back([&shop, t]() { shop(t + 1, 200000); });
+    }
+
+    for(auto& w : workers) {
+        w.join();
+    }
+
+    std::cout << "Hottest argument tuples for get_cost:" << std::endl;
+    metrics_registry::instance().print(std::cout);
+
+    // rough cost of the bookkeeping per call
+    const int calls = 5000000;
+    auto plain = visit_apples(&apples::calculate_cost);
+
+    auto start = std::chrono::steady_clock::now();
+    double a = 0;
+    for(int i = 0; i < calls; ++i) a += plain(groceries, 2 + (i & 1), 1.1);
+    auto mid = std::chrono::steady_clock::now();
+    double b = 0;
+    for(int i = 0; i < calls; ++i) b += get_cost(groceries, 2 + (i & 1), 1.1);
+    auto end = std::chrono::steady_clock::now();
+
+    auto ns = [calls](auto d) { return std::chrono::duration<double, std::nano>(d).count() / calls; };
+    std::cout << "\nplain:   " << ns(mid - start) << " ns/call"
+              << "\ntracked: " << ns(end - mid) << " ns/call"
+              << "\n(checksum " << (a == b) << ")" << std::endl;
+
+    return 0;
+}
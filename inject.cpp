@@ -0,0 +1,341 @@
+// fault and latency injection for decorated calls
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// inject(point, func) lets a benchmark see how a chain such as
+// log_time(output(exception_fail_safe(...))) behaves when the inner function
+// fails or slows down. A fault_point is a switch with a profile selected at
+// runtime. While a profile is active, each call draws from a per-thread PRNG
+// and may:
+//
+//   * throw the profile's exception,
+//   * return an error value, for result types that have one (see
+//     injected_error below); other types get the exception instead,
+//   * spin for busy_wait, or sleep for sleep, before calling func.
+//
+// Every thread's PRNG is seeded from fault_seed and the order in which
+// threads first inject, so a run with the same seed and the same calls
+// injects the same faults.
+//
+// With no profile selected a call costs one relaxed load. Build with
+// -DDECORATORS_FAULT_INJECTION=0 and inject() returns func unchanged.
+//
+//   g++ -std=c++17 -O2 inject.cpp
+//   ./a.out flaky_10 --seed 42
+
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <chrono>
+#include <ctime>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+#ifndef DECORATORS_FAULT_INJECTION
+    #define DECORATORS_FAULT_INJECTION 1
+#endif
+
+using namespace std;
+
+////////////////////////////////////
+//      optional type             //
+////////////////////////////////////
+template<typename T>
+struct optional_type {
+    T value;
+    bool OK;
+    bool BAD;
+    std::string msg;
+
+    optional_type(T&& t) : value(std::move(t)) { OK = true; BAD = false; }
+    optional_type(bool ok, std::string msg="") : msg(std::move(msg)) { OK = ok; BAD = !ok; }
+};
+
+//////////////////////////////////////
+//   fault profiles                 //
+//////////////////////////////////////
+
+struct injected_fault : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+inline void throw_injected_fault() { throw injected_fault("injected fault"); }
+
+// rates are per call and independent of each other
+struct fault_profile {
+    const char* name;
+    double throw_rate;
+    double error_rate;
+    double slow_rate;
+    std::chrono::nanoseconds busy_wait;
+    std::chrono::microseconds sleep;
+    void (*raise)();
+};
+
+namespace fault_profiles {
+    using namespace std::chrono_literals;
+
+    const fault_profile none       { "none",       0.0,  0.0,  0.0,  0ns,     0us,    throw_injected_fault };
+    const fault_profile flaky_10   { "flaky_10",   0.10, 0.0,  0.0,  0ns,     0us,    throw_injected_fault };
+    const fault_profile failing_50 { "failing_50", 0.0,  0.50, 0.0,  0ns,     0us,    throw_injected_fault };
+    const fault_profile slow_10    { "slow_10",    0.0,  0.0,  0.10, 20000ns, 0us,    throw_injected_fault };
+    const fault_profile sleepy_1   { "sleepy_1",   0.0,  0.0,  0.01, 0ns,     1000us, throw_injected_fault };
+    const fault_profile chaos      { "chaos",      0.05, 0.05, 0.05, 5000ns,  0us,    throw_injected_fault };
+
+    const fault_profile* const all[] = { &none, &flaky_10, &failing_50, &slow_10, &sleepy_1, &chaos };
+
+    inline const fault_profile* by_name(const std::string& name) {
+        for(const fault_profile* p : all) {
+            if(name == p->name) return p;
+        }
+        return nullptr;
+    }
+}
+
+// selects which profile, if any, a group of decorated functions runs under
+struct fault_point {
+    std::atomic<const fault_profile*> active{ nullptr };
+
+    void select(const fault_profile& p) { active.store(&p, std::memory_order_relaxed); }
+    void clear() { active.store(nullptr, std::memory_order_relaxed); }
+};
+
+// error values for result types that can carry one
+template<typename R>
+struct injected_error {
+    static constexpr bool available = false;
+};
+
+template<typename T>
+struct injected_error<optional_type<T>> {
+    static constexpr bool available = true;
+    static optional_type<T> make() { return optional_type<T>(false, "injected error"); }
+};
+
+//////////////////////////////////////
+//   deterministic randomness       //
+//////////////////////////////////////
+
+std::atomic<std::uint64_t> fault_seed{ 0x5eed };
+std::atomic<std::uint64_t> fault_threads{ 0 };
+
+inline std::uint64_t splitmix64(std::uint64_t& state) {
+    std::uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+inline std::uint64_t& fault_rng() {
+    thread_local std::uint64_t state =
+        fault_seed.load() ^ (fault_threads.fetch_add(1) + 1) * 0x9e3779b97f4a7c15ull;
+    return state;
+}
+
+// restarts this thread's sequence, e.g. to replay a failure
+inline void reseed_faults(std::uint64_t seed) {
+    fault_rng() = seed;
+}
+
+// uniform in [0, 1)
+inline double fault_draw() {
+    return double(splitmix64(fault_rng()) >> 11) * 0x1.0p-53;
+}
+
+inline void busy_wait(std::chrono::nanoseconds d) {
+    auto until = std::chrono::steady_clock::now() + d;
+    while(std::chrono::steady_clock::now() < until) { }
+}
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+#if DECORATORS_FAULT_INJECTION
+
+template<typename F>
+constexpr auto inject(fault_point& point, const F& func) {
+    return [point = &point, func](auto&&... args) -> decltype(auto) {
+        using R = decltype(func(std::forward<decltype(args)>(args)...));
+
+        const fault_profile* p = point->active.load(std::memory_order_relaxed);
+        if(p) {
+            if(p->slow_rate > 0 && fault_draw() < p->slow_rate) {
+                if(p->busy_wait.count()) busy_wait(p->busy_wait);
+                if(p->sleep.count()) std::this_thread::sleep_for(p->sleep);
+            }
+
+            if(p->throw_rate > 0 && fault_draw() < p->throw_rate) {
+                p->raise();
+            }
+
+            if(p->error_rate > 0 && fault_draw() < p->error_rate) {
+                if constexpr(injected_error<std::decay_t<R>>::available) {
+                    return R(injected_error<std::decay_t<R>>::make());
+                } else {
+                    p->raise();
+                }
+            }
+        }
+
+        return func(std::forward<decltype(args)>(args)...);
+    };
+}
+
+#else
+
+template<typename F>
+constexpr auto inject(fault_point&, const F& func) {
+    return func;
+}
+
+#endif
+
+// better_member_func.cpp's decorators
+template<typename F>
+constexpr auto exception_fail_safe(const F& func)  {
+    return [func](auto&&... args)
+    -> optional_type<decltype(func(std::forward<decltype(args)>(args)...))> {
+        using R = optional_type<decltype(func(std::forward<decltype(args)>(args)...))>;
+
+        try {
+            return R(func(std::forward<decltype(args)>(args)...));
+        } catch(std::iostream::failure& e) {
+            return R(false, e.what());
+        } catch(std::exception& e) {
+            return R(false, e.what());
+        } catch(...) {
+            // This ... catch clause will capture any exception thrown
+            return R(false, std::string("Exception caught: default exception"));
+        }
+    };
+}
+
+template<typename F>
+constexpr auto output(const F& func) {
+    return [func](auto&&... args) {
+        auto opt = func(std::forward<decltype(args)>(args)...);
+
+        if(opt.BAD) {
+            std::cout << "There was an error: " << opt.msg << std::endl;
+        } else {
+            std::cout << "Bag cost $" << opt.value << std::endl;
+        }
+
+        return opt;
+    };
+}
+
+template<typename F>
+constexpr auto log_time(const F& func) {
+    return [func](auto&&... args) {
+        auto now = std::chrono::system_clock::now();
+        std::time_t time = std::chrono::system_clock::to_time_t(now);
+        auto opt = func(std::forward<decltype(args)>(args)...);
+        std::cout << "> Logged at " << std::ctime(&time) << std::endl;
+
+        return opt;
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    double cost_per_apple;
+};
+
+////////////////////////////////////
+//    visitor function            //
+////////////////////////////////////
+
+template<typename F>
+constexpr auto visit_apples(const F& func) {
+    return [func](apples& a, auto&&... args) {
+        return (a.*func)(std::forward<decltype(args)>(args)...);
+    };
+}
+
+////////////////////////////////////
+// final decorated functions      //
+////////////////////////////////////
+
+fault_point cost_faults;     // inside the fail-safe: faults become caught exceptions
+fault_point result_faults;   // outside it: faults become error results
+
+constexpr auto get_cost = log_time(output(inject(result_faults,
+    exception_fail_safe(inject(cost_faults, visit_apples(&apples::calculate_cost))))));
+
+int main(int argc, char** argv) {
+    const fault_profile* chosen = &fault_profiles::flaky_10;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--seed" && i + 1 < argc) {
+            fault_seed = std::stoull(argv[++i]);
+        } else if(const fault_profile* p = fault_profiles::by_name(arg)) {
+            chosen = p;
+        }
+    }
+
+    apples groceries(1.09);
+
+    std::cout << "profile " << chosen->name << ", seed " << fault_seed << "\n" << std::endl;
+    cost_faults.select(*chosen);
+    for(int i = 0; i < 5; ++i) {
+        get_cost(groceries, 2, 1.1);
+    }
+    cost_faults.clear();
+
+    // the whole chain under each profile, output discarded
+    struct null_buffer : std::streambuf {
+        int overflow(int c) override { return c; }
+        std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+    } discard;
+
+    auto bench = [&](fault_point& point, const fault_profile* p) {
+        const int calls = 100000;
+        int failures = 0;
+
+        if(p) point.select(*p);
+        reseed_faults(fault_seed);
+        std::streambuf* console = std::cout.rdbuf(&discard);
+
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < calls; ++i) {
+            failures += get_cost(groceries, 2, 1.1).BAD;
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        std::cout.rdbuf(console);
+        point.clear();
+
+        std::cout << (&point == &cost_faults ? "inner " : "outer ") << (p ? p->name : "off") << ": "
+                  << std::chrono::duration<double, std::nano>(end - start).count() / calls << " ns/call, "
+                  << failures * 100.0 / calls << "% failed" << std::endl;
+    };
+
+    std::cout << std::endl;
+    bench(cost_faults, nullptr);
+    for(const fault_profile* p : fault_profiles::all) {
+        bench(cost_faults, p);
+    }
+    bench(result_faults, &fault_profiles::failing_50);
+
+    return 0;
+}
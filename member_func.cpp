@@ -35,7 +35,7 @@ struct optional_type {
 
 // exception decorator for optional return types
 template<typename F>
-auto exception_fail_safe(const F& func)  {
+constexpr auto exception_fail_safe(const F& func)  {
     return [func](auto&&... args) 
     -> optional_type<decltype(func(std::forward<decltype(args)>(args)...))> {
         using R = optional_type<decltype(func(std::forward<decltype(args)>(args)...))>;
@@ -54,14 +54,14 @@ auto exception_fail_safe(const F& func)  {
 }
 
 template<typename F>
-auto output(const F& func) {
+constexpr auto output(const F& func) {
     return [func](auto&&... args) {
         std::cout << func(std::forward<decltype(args)>(args)...) << std::endl;
     };
 }
 
 template<typename F>
-auto log_time(const F& func) {
+constexpr auto log_time(const F& func) {
     return [func](auto&&... args) {
         auto now = std::chrono::system_clock::now();
         std::time_t time = std::chrono::system_clock::to_time_t(now); 
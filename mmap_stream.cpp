@@ -0,0 +1,381 @@
+// out-of-core batch pricing over memory-mapped record files
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// A catalog of hundreds of millions of apple records does not fit in memory
+// as objects. This prices one straight from disk: the input file is mapped
+// read-only, the output file is mapped read-write at its final size, and the
+// driver walks both a chunk at a time. A chunk's input and output rows
+// together take half of L2, so the kernel's working set stays in cache.
+//
+// The kernel is calculate_cost decorated for batches:
+//
+//   exception_fail_safe(batch, stats, visit_record(&apples::calculate_cost))
+//
+// prices a chunk in one try region per run of good rows and writes an error
+// code for the rows that throw (see result_column.cpp); stats maps the codes
+// back to messages. chunk_metrics(stats, kernel) wraps that and records
+// each chunk's rows, errors and time.
+//
+// The driver tells the OS how it will read the files: MADV_SEQUENTIAL for
+// the whole input, MADV_WILLNEED a few chunks ahead, and MADV_DONTNEED for
+// chunks that are finished so resident memory stays flat however big the
+// file is. Dirty output pages stay in the page cache and are written back
+// in the background; msync at the end waits for them.
+//
+//   g++ -std=c++17 -O2 mmap_stream.cpp
+//   ./a.out 20000000 /tmp
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+//////////////////////////////////////
+//   record files                   //
+//////////////////////////////////////
+
+struct apple_record {
+    double cost_per_apple;
+    double weight;
+    std::int32_t count;
+    std::int32_t reserved;
+};
+
+// error 0 means cost is valid
+struct cost_record {
+    double cost;
+    std::uint32_t error;
+    std::uint32_t reserved;
+};
+
+static_assert(sizeof(apple_record) == 24 && sizeof(cost_record) == 16, "records are a file format");
+
+class mapped_file {
+public:
+    static mapped_file open_read(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        struct stat st;
+        if(fstat(fd, &st) != 0) {
+            int e = errno;
+            ::close(fd);
+            throw std::system_error(e, std::generic_category(), "stat " + path);
+        }
+
+        return mapped_file(fd, std::size_t(st.st_size), PROT_READ, path);
+    }
+
+    // creates or truncates path to exactly size bytes
+    static mapped_file create(const std::string& path, std::size_t size) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        if(ftruncate(fd, off_t(size)) != 0) {
+            int e = errno;
+            ::close(fd);
+            throw std::system_error(e, std::generic_category(), "resize " + path);
+        }
+
+        return mapped_file(fd, size, PROT_READ | PROT_WRITE, path);
+    }
+
+    mapped_file(mapped_file&& other) noexcept
+        : fd(std::exchange(other.fd, -1)), bytes(std::exchange(other.bytes, nullptr)), length(other.length) { }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    mapped_file& operator=(mapped_file&&) = delete;
+
+    ~mapped_file() {
+        if(bytes) munmap(bytes, length);
+        if(fd >= 0) ::close(fd);
+    }
+
+    template<typename T> T* as() const { return static_cast<T*>(bytes); }
+    std::size_t size() const { return length; }
+
+    // advice is a hint; a kernel that ignores it only costs us speed
+    void advise(std::size_t offset, std::size_t n, int advice) const {
+        std::size_t page = std::size_t(sysconf(_SC_PAGESIZE));
+        std::size_t begin = offset / page * page;
+        std::size_t end = std::min(offset + n, length);
+        if(begin < end) madvise(static_cast<char*>(bytes) + begin, end - begin, advice);
+    }
+
+    void sync() const {
+        if(bytes && msync(bytes, length, MS_SYNC) != 0) {
+            throw std::system_error(errno, std::generic_category(), "msync");
+        }
+    }
+
+private:
+    mapped_file(int fd, std::size_t size, int protection, const std::string& path) : fd(fd), length(size) {
+        if(size == 0) return;
+
+        void* p = mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+        if(p == MAP_FAILED) {
+            int e = errno;
+            ::close(fd);
+            this->fd = -1;
+            throw std::system_error(e, std::generic_category(), "mmap " + path);
+        }
+        bytes = p;
+    }
+
+    int fd = -1;
+    void* bytes = nullptr;
+    std::size_t length = 0;
+};
+
+inline std::size_t l2_cache_bytes() {
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+    long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if(size > 0) return std::size_t(size);
+#endif
+    return std::size_t(1) << 20;
+}
+
+//////////////////////////////////////
+//   chunk statistics               //
+//////////////////////////////////////
+
+struct chunk_sample {
+    std::size_t rows;
+    std::size_t errors;
+    double ns;
+};
+
+struct stream_stats {
+    std::vector<chunk_sample> chunks;
+    std::vector<std::string> messages;   // error code n is messages[n - 1]
+
+    std::uint32_t code_for(const char* msg) {
+        for(std::size_t i = 0; i < messages.size(); ++i) {
+            if(messages[i] == msg) return std::uint32_t(i + 1);
+        }
+        messages.emplace_back(msg);
+        return std::uint32_t(messages.size());
+    }
+
+    std::size_t rows() const {
+        std::size_t n = 0;
+        for(auto& c : chunks) n += c.rows;
+        return n;
+    }
+
+    std::size_t errors() const {
+        std::size_t n = 0;
+        for(auto& c : chunks) n += c.errors;
+        return n;
+    }
+};
+
+/////////////////////////////////////
+//          decorators             //
+/////////////////////////////////////
+
+struct batch_tag { };
+inline constexpr batch_tag batch{};
+
+// prices in[0..n) into out[0..n) and returns the number of failed rows.
+// One try region covers each run of good rows; a row that throws gets the
+// error code for its message and the chunk resumes after it.
+template<typename F>
+constexpr auto exception_fail_safe(batch_tag, stream_stats& stats, const F& func) {
+    return [func, stats = &stats](const apple_record* in, cost_record* out, std::size_t n) {
+        std::size_t errors = 0;
+        std::size_t i = 0;
+
+        while(i < n) {
+            try {
+                for(; i < n; ++i) {
+                    out[i] = cost_record{ func(in[i]), 0, 0 };
+                }
+            } catch(std::exception& e) {
+                out[i++] = cost_record{ 0, stats->code_for(e.what()), 0 };
+                ++errors;
+            } catch(...) {
+                out[i++] = cost_record{ 0, stats->code_for("Exception caught: default exception"), 0 };
+                ++errors;
+            }
+        }
+
+        return errors;
+    };
+}
+
+// records rows, errors and time for every chunk the kernel prices
+template<typename F>
+constexpr auto chunk_metrics(stream_stats& stats, const F& kernel) {
+    return [kernel, stats = &stats](const apple_record* in, cost_record* out, std::size_t n) {
+        auto start = std::chrono::steady_clock::now();
+        std::size_t errors = kernel(in, out, n);
+        auto end = std::chrono::steady_clock::now();
+
+        stats->chunks.push_back(chunk_sample{ n, errors, std::chrono::duration<double, std::nano>(end - start).count() });
+        return errors;
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    double cost_per_apple;
+};
+
+////////////////////////////////////
+//    visitor function            //
+////////////////////////////////////
+
+// every record carries its own price, so each one is its own apples
+template<typename F>
+constexpr auto visit_record(const F& func) {
+    return [func](const apple_record& r) {
+        apples a(r.cost_per_apple);
+        return (a.*func)(r.count, r.weight);
+    };
+}
+
+//////////////////////////////
+// function implementations //
+//////////////////////////////
+
+// a catalog with one bad record in ten thousand
+void write_catalog(const std::string& path, std::size_t records) {
+    mapped_file out = mapped_file::create(path, records * sizeof(apple_record));
+    apple_record* r = out.as<apple_record>();
+
+    for(std::size_t i = 0; i < records; ++i) {
+        r[i] = apple_record{ 0.5 + double(i % 13) * 0.25, i % 10000 == 4999 ? 0.0 : 0.5 + double(i % 7) * 0.25,
+                             i % 20000 == 19999 ? 0 : int(i % 12) + 1, 0 };
+    }
+    out.sync();
+}
+
+template<typename Kernel>
+void stream_catalog(const std::string& in_path, const std::string& out_path, std::size_t chunk_rows,
+                    const Kernel& kernel) {
+    mapped_file in = mapped_file::open_read(in_path);
+    if(in.size() % sizeof(apple_record) != 0) {
+        throw std::runtime_error(in_path + " is not a whole number of records");
+    }
+
+    std::size_t rows = in.size() / sizeof(apple_record);
+    mapped_file out = mapped_file::create(out_path, rows * sizeof(cost_record));
+
+    const apple_record* records = in.as<apple_record>();
+    cost_record* costs = out.as<cost_record>();
+    const std::size_t readahead = 4;   // chunks
+
+    in.advise(0, in.size(), MADV_SEQUENTIAL);
+    in.advise(0, readahead * chunk_rows * sizeof(apple_record), MADV_WILLNEED);
+
+    for(std::size_t first = 0; first < rows; first += chunk_rows) {
+        std::size_t n = std::min(chunk_rows, rows - first);
+
+        in.advise((first + readahead * chunk_rows) * sizeof(apple_record), chunk_rows * sizeof(apple_record), MADV_WILLNEED);
+        kernel(records + first, costs + first, n);
+
+        // finished: drop our mappings of these pages, the page cache keeps them
+        in.advise(first * sizeof(apple_record), n * sizeof(apple_record), MADV_DONTNEED);
+        out.advise(first * sizeof(cost_record), n * sizeof(cost_record), MADV_DONTNEED);
+    }
+
+    out.sync();
+}
+
+///////////////////////////////
+// final decorated functions //
+///////////////////////////////
+
+stream_stats catalog_stats;
+
+const auto price_chunk = chunk_metrics(catalog_stats,
+    exception_fail_safe(batch, catalog_stats, visit_record(&apples::calculate_cost)));
+
+int main(int argc, char** argv) {
+    std::size_t records = argc > 1 ? std::stoull(argv[1]) : 4000000;
+    std::string dir = argc > 2 ? argv[2] : "/tmp";
+    std::string in_path = dir + "/apples.bin", out_path = dir + "/costs.bin";
+
+    // input and output rows of one chunk share half of L2
+    std::size_t chunk_rows = l2_cache_bytes() / 2 / (sizeof(apple_record) + sizeof(cost_record));
+    double seconds = 0;
+
+    try {
+        write_catalog(in_path, records);
+
+        auto start = std::chrono::steady_clock::now();
+        stream_catalog(in_path, out_path, chunk_rows, price_chunk);
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // spot check a few rows against the undecorated member function
+        mapped_file in = mapped_file::open_read(in_path);
+        mapped_file out = mapped_file::open_read(out_path);
+        for(std::size_t i : { std::size_t(0), std::size_t(4999), records / 2, records - 1 }) {
+            if(i >= records) continue;
+            const apple_record& r = in.as<apple_record>()[i];
+            const cost_record& c = out.as<cost_record>()[i];
+
+            std::cout << "record " << i << ": ";
+            if(c.error) {
+                std::cout << "There was an error: " << catalog_stats.messages[c.error - 1] << "\n";
+            } else {
+                std::cout << "Bag cost $" << c.cost << " (expected $" << apples(r.cost_per_apple).calculate_cost(r.count, r.weight) << ")\n";
+            }
+        }
+    } catch(std::exception& e) {
+        std::cout << "There was an error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::vector<double> times;
+    for(auto& c : catalog_stats.chunks) times.push_back(c.ns);
+    std::sort(times.begin(), times.end());
+    double kernel_ns = 0;
+    for(double t : times) kernel_ns += t;
+
+    auto percentile = [&](double p) { return times.empty() ? 0.0 : times[std::size_t(p * (times.size() - 1))] / 1e3; };
+    double mb = double(records) * (sizeof(apple_record) + sizeof(cost_record)) / 1e6;
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "\n" << catalog_stats.rows() << " records in " << catalog_stats.chunks.size() << " chunks of "
+              << chunk_rows << " rows (L2 " << l2_cache_bytes() / 1024 << " KiB)\n"
+              << "  errors:     " << catalog_stats.errors() << "\n"
+              << "  total:      " << seconds * 1e3 << " ms, " << mb / seconds << " MB/s in+out, "
+              << records / seconds / 1e6 << " M records/s\n"
+              << "  in kernel:  " << kernel_ns / 1e6 << " ms; per chunk p50 " << percentile(0.5)
+              << " us, p99 " << percentile(0.99) << " us, max " << percentile(1.0) << " us" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,408 @@
+// pooled results for functions returning expensive objects
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// pooled_result(func) calls func and returns the result in a pooled<R>
+// handle instead of by value. When the handle dies, the object goes back to
+// a pool rather than being destroyed, and the next call reuses it.
+//
+// pooled_result<R>(fill) goes further. fill(R& out, args...) rewrites the
+// recycled object in place, so vectors and strings keep their capacity and
+// a warm call does not allocate at all.
+//
+// Each thread has its own pool. A handle released on the thread that
+// acquired it goes straight back on that thread's free list. A handle
+// released anywhere else is pushed onto its home pool's lock-free return
+// stack, which the owner drains the next time its free list runs dry. Both
+// are bounded by pool_capacity, and anything over is simply deleted.
+//
+//   g++ -std=c++17 -O2 -pthread pool.cpp
+
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <string>
+#include <chrono>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+using namespace std;
+
+//////////////////////////////////////
+//   per-thread pools               //
+//////////////////////////////////////
+
+constexpr std::size_t pool_capacity = 64;
+
+struct pool_stats {
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::uint64_t remote_returns;
+    std::uint64_t discarded;
+};
+
+template<typename R> struct pool_home;
+
+template<typename R>
+struct pool_node {
+    std::optional<R> value;
+    pool_home<R>* home = nullptr;
+    pool_node* next = nullptr;
+};
+
+template<typename R>
+struct pool_home {
+    using node = pool_node<R>;
+
+    // the registry destroys the homes at exit, with whatever is still pooled
+    ~pool_home() {
+        node* n = returned.exchange(nullptr, std::memory_order_acquire);
+        while(n) {
+            node* next = n->next;
+            delete n;
+            n = next;
+        }
+
+        for(node* f : free) {
+            delete f;
+        }
+    }
+
+    // owner thread only
+    node* acquire() {
+        if(free.empty()) {
+            drain_returns();
+        }
+
+        if(free.empty()) {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            node* n = new node();
+            n->home = this;
+            return n;
+        }
+
+        hits.fetch_add(1, std::memory_order_relaxed);
+        node* n = free.back();
+        free.pop_back();
+        return n;
+    }
+
+    // owner thread only
+    void release_local(node* n) {
+        if(free.size() < pool_capacity) {
+            free.push_back(n);
+        } else {
+            discarded.fetch_add(1, std::memory_order_relaxed);
+            delete n;
+        }
+    }
+
+    // any other thread: a Treiber push. Only the owner pops, and it takes
+    // the whole stack at once, so there is no ABA problem.
+    void release_remote(node* n) {
+        if(returned_count.fetch_add(1, std::memory_order_relaxed) >= pool_capacity) {
+            returned_count.fetch_sub(1, std::memory_order_relaxed);
+            discarded.fetch_add(1, std::memory_order_relaxed);
+            delete n;
+            return;
+        }
+
+        remote_returns.fetch_add(1, std::memory_order_relaxed);
+        n->next = returned.load(std::memory_order_relaxed);
+        while(!returned.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed)) { }
+    }
+
+    void drain_returns() {
+        node* n = returned.exchange(nullptr, std::memory_order_acquire);
+        while(n) {
+            node* next = n->next;
+            returned_count.fetch_sub(1, std::memory_order_relaxed);
+            release_local(n);
+            n = next;
+        }
+    }
+
+    std::vector<node*> free;
+    std::atomic<node*> returned{ nullptr };
+    std::atomic<std::size_t> returned_count{ 0 };
+
+    std::atomic<std::uint64_t> hits{ 0 };
+    std::atomic<std::uint64_t> misses{ 0 };
+    std::atomic<std::uint64_t> remote_returns{ 0 };
+    std::atomic<std::uint64_t> discarded{ 0 };
+};
+
+// homes outlive their threads: an exiting thread leaves its home to the
+// next thread that starts, so late remote returns always have somewhere to go
+template<typename R>
+struct pool_registry {
+    static pool_registry& instance() {
+        static pool_registry registry;
+        return registry;
+    }
+
+    pool_home<R>* adopt() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!orphans.empty()) {
+            pool_home<R>* home = orphans.back();
+            orphans.pop_back();
+            return home;
+        }
+
+        homes.push_back(std::make_unique<pool_home<R>>());
+        return homes.back().get();
+    }
+
+    void abandon(pool_home<R>* home) {
+        std::lock_guard<std::mutex> lock(mutex);
+        orphans.push_back(home);
+    }
+
+    pool_stats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        pool_stats total{};
+        for(auto& h : homes) {
+            total.hits += h->hits.load(std::memory_order_relaxed);
+            total.misses += h->misses.load(std::memory_order_relaxed);
+            total.remote_returns += h->remote_returns.load(std::memory_order_relaxed);
+            total.discarded += h->discarded.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<pool_home<R>>> homes;
+    std::vector<pool_home<R>*> orphans;
+};
+
+template<typename R>
+pool_home<R>& this_thread_pool() {
+    thread_local struct holder {
+        pool_home<R>* home = pool_registry<R>::instance().adopt();
+        ~holder() { pool_registry<R>::instance().abandon(home); }
+    } pool;
+
+    return *pool.home;
+}
+
+// hit/miss counters summed over every thread's pool for R
+template<typename R>
+pool_stats pooled_stats() {
+    return pool_registry<R>::instance().stats();
+}
+
+// move-only handle, like a unique_ptr that returns its object to the pool
+template<typename R>
+class pooled {
+public:
+    explicit pooled(pool_node<R>* n) : n(n) { }
+    pooled(pooled&& other) noexcept : n(std::exchange(other.n, nullptr)) { }
+
+    pooled& operator=(pooled&& other) noexcept {
+        if(this != &other) {
+            reset();
+            n = std::exchange(other.n, nullptr);
+        }
+        return *this;
+    }
+
+    ~pooled() { reset(); }
+
+    R& operator*() const { return *n->value; }
+    R* operator->() const { return &*n->value; }
+
+    void reset() {
+        if(!n) return;
+
+        pool_home<R>& mine = this_thread_pool<R>();
+        if(n->home == &mine) {
+            mine.release_local(n);
+        } else {
+            n->home->release_remote(n);
+        }
+        n = nullptr;
+    }
+
+private:
+    pool_node<R>* n;
+};
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+// func returns R by value; the result is moved into a recycled R
+template<typename F>
+constexpr auto pooled_result(const F& func) {
+    return [func](auto&&... args) {
+        using R = std::decay_t<decltype(func(std::forward<decltype(args)>(args)...))>;
+
+        pool_node<R>* n = this_thread_pool<R>().acquire();
+        pooled<R> handle(n);
+
+        if(n->value) {
+            *n->value = func(std::forward<decltype(args)>(args)...);
+        } else {
+            n->value.emplace(func(std::forward<decltype(args)>(args)...));
+        }
+
+        return handle;
+    };
+}
+
+// fill(R& out, args...) overwrites a recycled (or freshly built) R in place
+template<typename R, typename F>
+constexpr auto pooled_result(const F& fill) {
+    return [fill](auto&&... args) {
+        pool_node<R>* n = this_thread_pool<R>().acquire();
+        pooled<R> handle(n);
+
+        if(!n->value) {
+            n->value.emplace();
+        }
+
+        fill(*n->value, std::forward<decltype(args)>(args)...);
+        return handle;
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    double cost_per_apple;
+};
+
+// a big result: the price of every bag size up to `bags`
+struct price_report {
+    std::vector<double> costs;
+    std::string summary;
+};
+
+//////////////////////////////
+// function implementations //
+//////////////////////////////
+
+price_report make_report_impl(apples& a, int bags, double weight) {
+    price_report report;
+    report.costs.reserve(bags);
+    for(int count = 1; count <= bags; ++count) {
+        report.costs.push_back(a.calculate_cost(count, weight));
+    }
+
+    report.summary = "price list for " + std::to_string(bags) + " bag sizes of apples";
+    return report;
+}
+
+// the same report, written into an existing one
+void fill_report_impl(price_report& report, apples& a, int bags, double weight) {
+    report.costs.clear();
+    for(int count = 1; count <= bags; ++count) {
+        report.costs.push_back(a.calculate_cost(count, weight));
+    }
+
+    report.summary.assign("price list for ");
+    report.summary += std::to_string(bags);
+    report.summary += " bag sizes of apples";
+}
+
+///////////////////////////////
+// final decorated functions //
+///////////////////////////////
+
+constexpr auto make_report = pooled_result(make_report_impl);
+constexpr auto fill_report = pooled_result<price_report>(fill_report_impl);
+
+int main() {
+    apples groceries(1.09);
+
+    {
+        auto report = fill_report(groceries, 4, 1.1);
+        std::cout << report->summary << ": $" << report->costs.back() << std::endl;
+    }
+
+    try {
+        fill_report(groceries, 4, 0.0);
+    } catch(std::exception& e) {
+        std::cout << "There was an error: " << e.what() << "\n" << std::endl;
+    }
+
+    auto bench = [&](const char* label, const auto& f) {
+        const int calls = 200000;
+        double sum = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < calls; ++i) {
+            auto report = f(groceries, 256, 1.1);
+            sum += (*report).costs[i & 255];
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        std::cout << label << std::chrono::duration<double, std::nano>(end - start).count() / calls
+                  << " ns/call (checksum " << sum << ")" << std::endl;
+    };
+
+    // wrap the plain result so all three can be dereferenced the same way
+    bench("by value:           ", [](apples& a, int bags, double weight) {
+        return std::make_optional(make_report_impl(a, bags, weight));
+    });
+    bench("pooled_result:      ", make_report);
+    bench("pooled_result fill: ", fill_report);
+
+    // reports built on one thread and dropped on another travel home through
+    // the return stack
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::vector<pooled<price_report>> handoff;
+    bool done = false;
+
+    std::thread consumer([&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for(;;) {
+            ready.wait(lock, [&]() { return done || !handoff.empty(); });
+            handoff.clear();
+            if(done) return;
+        }
+    });
+
+    for(int i = 0; i < 100000; ++i) {
+        auto report = fill_report(groceries, 64, 1.1);
+        std::lock_guard<std::mutex> lock(mutex);
+        handoff.push_back(std::move(report));
+        ready.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    ready.notify_one();
+    consumer.join();
+
+    pool_stats stats = pooled_stats<price_report>();
+    std::cout << "\nprice_report pool: " << stats.hits << " hits, " << stats.misses << " misses, "
+              << stats.remote_returns << " remote returns, " << stats.discarded << " discarded" << std::endl;
+
+    return 0;
+}
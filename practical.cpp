@@ -17,7 +17,7 @@ using namespace std;
 // see https://github.com/TheMaverickProgrammer/C-Python-like-Decorators/blob/master/README.md#further-applications-decorating-member-functions
 // for a more robust example
 template<typename F>
-auto exception_fail_safe(const F& func) {
+constexpr auto exception_fail_safe(const F& func) {
     return [func](auto&&... args) {
         try {
             func(std::forward<decltype(args)>(args)...);
@@ -33,14 +33,14 @@ auto exception_fail_safe(const F& func) {
 }
 
 template<typename F>
-auto output(const F& func) {
+constexpr auto output(const F& func) {
     return [func](auto&&... args) {
         std::cout << func(std::forward<decltype(args)>(args)...) << std::endl;
     };
 }
 
 template<typename F>
-auto log_time(const F& func) {
+constexpr auto log_time(const F& func) {
     return [func](auto&&... args) {
         auto now = std::chrono::system_clock::now();
         std::time_t time = std::chrono::system_clock::to_time_t(now); 
@@ -63,8 +63,16 @@ void file_read_impl(const char* path, char* data, int* sz) {
 // final decorated functions //
 ///////////////////////////////
 
-auto file_read = exception_fail_safe(file_read_impl);
-auto print_file_read = log_time(output(file_read));
+constexpr auto file_read = exception_fail_safe(file_read_impl);
+constexpr auto print_file_read = log_time(output(file_read));
+
+// copying reads the captures, which only compiles for constant-initialized
+// globals; a plain `auto` above would need a static initializer at startup
+template<typename T>
+constexpr bool constant_initialized(const T& t) { T copy = t; (void)copy; return true; }
+
+static_assert(constant_initialized(file_read) && constant_initialized(print_file_read),
+              "decorated globals must be constant initialized");
 
 int main() {
     // some demo dummy data for our mock file read...
@@ -0,0 +1,724 @@
+// lock-free queues for asynchronous decorators
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// Decorators that hand work to another thread (actors, pipelines, async
+// logging) need a queue in the middle. This file collects the ones they use:
+//
+//   bounded_queue<T>         multi-producer multi-consumer ring (Vyukov). Every
+//                            slot carries a sequence number, so producers and
+//                            consumers only contend on their own index.
+//   mpsc_queue<T>            the same ring with a plain, uncontended dequeue.
+//   spsc_queue<T>            Lamport ring with cached indices: no read-modify-
+//                            write at all.
+//   unbounded_queue<T>       MPMC list of fixed-size segments. Drained
+//                            segments are freed through hazard pointers.
+//
+// The bounded queues also move whole batches with push_batch/pop_batch, which
+// claim a run of slots with a single index update.
+//
+// main() benchmarks throughput and latency for several producer/consumer
+// ratios and shows an async timing decorator built on mpsc_queue.
+//
+//   g++ -std=c++17 -O2 -pthread queues.cpp
+
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+using namespace std;
+
+inline std::uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void cpu_relax(unsigned& spins) {
+    if(++spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else {
+        spins = 0;
+        std::this_thread::yield();
+    }
+}
+
+inline std::size_t round_up_pow2(std::size_t n) {
+    std::size_t p = 2;
+    while(p < n) p <<= 1;
+    return p;
+}
+
+//////////////////////////////////////
+//   bounded MPMC / MPSC ring       //
+//////////////////////////////////////
+
+// slot i is free for the producer at position p when sequence == p, and
+// holds an item for the consumer at position p when sequence == p + 1
+template<typename T, bool MultiProducer = true, bool MultiConsumer = true>
+class bounded_queue {
+    struct slot {
+        std::atomic<std::size_t> sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* item() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
+
+public:
+    explicit bounded_queue(std::size_t capacity)
+        : mask(round_up_pow2(capacity) - 1), slots(new slot[mask + 1]) {
+        for(std::size_t i = 0; i <= mask; ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bounded_queue(const bounded_queue&) = delete;
+    bounded_queue& operator=(const bounded_queue&) = delete;
+
+    ~bounded_queue() {
+        T discard;
+        while(try_pop(discard)) { }
+    }
+
+    std::size_t capacity() const { return mask + 1; }
+
+    template<typename U>
+    bool try_push(U&& value) {
+        std::size_t pos;
+        if(!claim(enqueue_pos, 0, 1, pos)) return false;
+
+        slot& s = slots[pos & mask];
+        ::new(static_cast<void*>(s.storage)) T(std::forward<U>(value));
+        s.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& out) {
+        std::size_t pos;
+        if(!claim(dequeue_pos, 1, 1, pos)) return false;
+
+        slot& s = slots[pos & mask];
+        out = std::move(*s.item());
+        s.item()->~T();
+        s.sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // pushes up to n items from first, returns how many went in
+    template<typename It>
+    std::size_t push_batch(It first, std::size_t n) {
+        std::size_t pos;
+        std::size_t k = claim(enqueue_pos, 0, n, pos);
+
+        for(std::size_t i = 0; i < k; ++i, ++first) {
+            slot& s = slots[(pos + i) & mask];
+            ::new(static_cast<void*>(s.storage)) T(*first);
+            s.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+
+        return k;
+    }
+
+    // pops up to n items into out, returns how many came out
+    template<typename It>
+    std::size_t pop_batch(It out, std::size_t n) {
+        std::size_t pos;
+        std::size_t k = claim(dequeue_pos, 1, n, pos);
+
+        for(std::size_t i = 0; i < k; ++i, ++out) {
+            slot& s = slots[(pos + i) & mask];
+            *out = std::move(*s.item());
+            s.item()->~T();
+            s.sequence.store(pos + i + mask + 1, std::memory_order_release);
+        }
+
+        return k;
+    }
+
+private:
+    // claims up to n consecutive positions whose slots are ready
+    // (sequence == position + offset). Returns the count, 0 when the ring is
+    // full (producers) or empty (consumers).
+    std::size_t claim(std::atomic<std::size_t>& index, std::size_t offset, std::size_t n, std::size_t& pos) {
+        const bool contended = &index == &enqueue_pos ? MultiProducer : MultiConsumer;
+
+        pos = index.load(std::memory_order_relaxed);
+        for(;;) {
+            std::size_t k = 0;
+            while(k < n && slots[(pos + k) & mask].sequence.load(std::memory_order_acquire) == pos + k + offset) {
+                ++k;
+            }
+
+            if(k == 0) {
+                std::size_t seq = slots[pos & mask].sequence.load(std::memory_order_acquire);
+                if(std::intptr_t(seq - (pos + offset)) < 0) return 0;
+
+                // another thread got this position first
+                pos = index.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            if(!contended) {
+                index.store(pos + k, std::memory_order_relaxed);
+                return k;
+            }
+
+            if(index.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+                return k;
+            }
+        }
+    }
+
+    const std::size_t mask;
+    std::unique_ptr<slot[]> slots;
+
+    alignas(64) std::atomic<std::size_t> enqueue_pos{ 0 };
+    alignas(64) std::atomic<std::size_t> dequeue_pos{ 0 };
+};
+
+//////////////////////////////////////
+//   bounded SPSC ring              //
+//////////////////////////////////////
+
+// each side owns one index and keeps a stale copy of the other's, re-reading
+// it only when the ring looks full (producer) or empty (consumer)
+template<typename T>
+class bounded_queue<T, false, false> {
+public:
+    explicit bounded_queue(std::size_t capacity)
+        : mask(round_up_pow2(capacity) - 1), storage(new slot[mask + 1]) { }
+
+    bounded_queue(const bounded_queue&) = delete;
+    bounded_queue& operator=(const bounded_queue&) = delete;
+
+    ~bounded_queue() {
+        T discard;
+        while(try_pop(discard)) { }
+    }
+
+    std::size_t capacity() const { return mask + 1; }
+
+    template<typename U>
+    bool try_push(U&& value) {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        if(free_slots(t) == 0) return false;
+
+        ::new(static_cast<void*>(storage[t & mask].bytes)) T(std::forward<U>(value));
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& out) {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        if(used_slots(h) == 0) return false;
+
+        out = std::move(*storage[h & mask].item());
+        storage[h & mask].item()->~T();
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    template<typename It>
+    std::size_t push_batch(It first, std::size_t n) {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        std::size_t k = std::min(n, free_slots(t, n));
+
+        for(std::size_t i = 0; i < k; ++i, ++first) {
+            ::new(static_cast<void*>(storage[(t + i) & mask].bytes)) T(*first);
+        }
+
+        tail.store(t + k, std::memory_order_release);
+        return k;
+    }
+
+    template<typename It>
+    std::size_t pop_batch(It out, std::size_t n) {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        std::size_t k = std::min(n, used_slots(h, n));
+
+        for(std::size_t i = 0; i < k; ++i, ++out) {
+            slot& s = storage[(h + i) & mask];
+            *out = std::move(*s.item());
+            s.item()->~T();
+        }
+
+        head.store(h + k, std::memory_order_release);
+        return k;
+    }
+
+private:
+    struct slot {
+        alignas(T) unsigned char bytes[sizeof(T)];
+        T* item() { return std::launder(reinterpret_cast<T*>(bytes)); }
+    };
+
+    // producer side
+    std::size_t free_slots(std::size_t t, std::size_t wanted = 1) {
+        if(mask + 1 - (t - cached_head) < wanted) {
+            cached_head = head.load(std::memory_order_acquire);
+        }
+        return mask + 1 - (t - cached_head);
+    }
+
+    // consumer side
+    std::size_t used_slots(std::size_t h, std::size_t wanted = 1) {
+        if(cached_tail - h < wanted) {
+            cached_tail = tail.load(std::memory_order_acquire);
+        }
+        return cached_tail - h;
+    }
+
+    const std::size_t mask;
+    std::unique_ptr<slot[]> storage;
+
+    alignas(64) std::atomic<std::size_t> tail{ 0 };
+    std::size_t cached_head = 0;
+
+    alignas(64) std::atomic<std::size_t> head{ 0 };
+    std::size_t cached_tail = 0;
+};
+
+template<typename T>
+using mpmc_queue = bounded_queue<T, true, true>;
+
+template<typename T>
+using mpsc_queue = bounded_queue<T, true, false>;
+
+template<typename T>
+using spsc_queue = bounded_queue<T, false, false>;
+
+//////////////////////////////////////
+//   hazard pointers                //
+//////////////////////////////////////
+
+constexpr std::size_t max_hazard_threads = 256;
+
+// one published pointer per thread: "I may be reading this segment"
+struct hazard_table {
+    static hazard_table& instance() {
+        static hazard_table table;
+        return table;
+    }
+
+    std::size_t acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!free.empty()) {
+            std::size_t i = free.back();
+            free.pop_back();
+            return i;
+        }
+
+        if(next == max_hazard_threads) {
+            throw std::length_error("more than max_hazard_threads threads use unbounded_queue");
+        }
+
+        return next++;
+    }
+
+    void release(std::size_t i) {
+        slots[i].pointer.store(nullptr, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(mutex);
+        free.push_back(i);
+    }
+
+    bool is_hazardous(const void* p) const {
+        for(const auto& s : slots) {
+            if(s.pointer.load(std::memory_order_seq_cst) == p) return true;
+        }
+        return false;
+    }
+
+    struct alignas(64) slot {
+        std::atomic<const void*> pointer{ nullptr };
+    };
+
+    slot slots[max_hazard_threads];
+
+private:
+    std::mutex mutex;
+    std::vector<std::size_t> free;
+    std::size_t next = 0;
+};
+
+inline std::atomic<const void*>& this_thread_hazard() {
+    thread_local struct holder {
+        std::size_t index = hazard_table::instance().acquire();
+        ~holder() { hazard_table::instance().release(index); }
+    } hazard;
+
+    return hazard_table::instance().slots[hazard.index].pointer;
+}
+
+// reads `source` and publishes the pointer before using it; the re-check
+// proves it was still reachable once the hazard was visible
+template<typename P>
+P* protect(const std::atomic<P*>& source, std::atomic<const void*>& hazard) {
+    P* p = source.load(std::memory_order_relaxed);
+    for(;;) {
+        hazard.store(p, std::memory_order_seq_cst);
+        P* again = source.load(std::memory_order_seq_cst);
+        if(again == p) return p;
+        p = again;
+    }
+}
+
+//////////////////////////////////////
+//   unbounded MPMC queue           //
+//////////////////////////////////////
+
+// every slot of a segment is used once. Producers take slots with one
+// fetch_add; a full segment gets a successor linked behind it.
+template<typename T, std::size_t SegmentSize = 1024>
+class unbounded_queue {
+    struct segment {
+        std::atomic<std::size_t> enqueued{ 0 };
+        alignas(64) std::atomic<std::size_t> dequeued{ 0 };
+        alignas(64) std::atomic<segment*> next{ nullptr };
+        std::atomic<bool> ready[SegmentSize] = {};
+        alignas(T) unsigned char storage[SegmentSize][sizeof(T)];
+
+        T* item(std::size_t i) { return std::launder(reinterpret_cast<T*>(storage[i])); }
+    };
+
+public:
+    unbounded_queue() {
+        segment* first = new segment();
+        head.store(first, std::memory_order_relaxed);
+        tail.store(first, std::memory_order_relaxed);
+    }
+
+    unbounded_queue(const unbounded_queue&) = delete;
+    unbounded_queue& operator=(const unbounded_queue&) = delete;
+
+    ~unbounded_queue() {
+        T discard;
+        while(try_pop(discard)) { }
+
+        for(segment* s = head.load(); s; ) {
+            segment* next = s->next.load();
+            delete s;
+            s = next;
+        }
+
+        for(segment* s : retired) delete s;
+    }
+
+    template<typename U>
+    void push(U&& value) {
+        auto& hazard = this_thread_hazard();
+
+        for(;;) {
+            segment* s = protect(tail, hazard);
+            std::size_t i = s->enqueued.fetch_add(1, std::memory_order_relaxed);
+
+            if(i < SegmentSize) {
+                ::new(static_cast<void*>(s->storage[i])) T(std::forward<U>(value));
+                s->ready[i].store(true, std::memory_order_release);
+                hazard.store(nullptr, std::memory_order_release);
+                return;
+            }
+
+            // segment full: link a successor (or find the one someone else
+            // linked) and move the tail along
+            segment* next = s->next.load(std::memory_order_acquire);
+            if(!next) {
+                segment* fresh = new segment();
+                if(s->next.compare_exchange_strong(next, fresh, std::memory_order_acq_rel)) {
+                    next = fresh;
+                } else {
+                    delete fresh;
+                }
+            }
+
+            tail.compare_exchange_strong(s, next, std::memory_order_acq_rel);
+        }
+    }
+
+    bool try_pop(T& out) {
+        auto& hazard = this_thread_hazard();
+
+        for(;;) {
+            segment* s = protect(head, hazard);
+            std::size_t i = s->dequeued.load(std::memory_order_acquire);
+
+            if(i < SegmentSize) {
+                // empty, or the producer of slot i is still writing
+                if(!s->ready[i].load(std::memory_order_acquire)) {
+                    hazard.store(nullptr, std::memory_order_release);
+                    return false;
+                }
+
+                if(s->dequeued.compare_exchange_weak(i, i + 1, std::memory_order_acq_rel)) {
+                    out = std::move(*s->item(i));
+                    s->item(i)->~T();
+                    hazard.store(nullptr, std::memory_order_release);
+                    return true;
+                }
+
+                continue;
+            }
+
+            segment* next = s->next.load(std::memory_order_acquire);
+            if(!next) {
+                hazard.store(nullptr, std::memory_order_release);
+                return false;
+            }
+
+            // the tail must be past s too before s can be retired
+            segment* expected = s;
+            tail.compare_exchange_strong(expected, next, std::memory_order_acq_rel);
+
+            if(head.compare_exchange_strong(s, next, std::memory_order_acq_rel)) {
+                hazard.store(nullptr, std::memory_order_release);
+                retire(s);
+            }
+        }
+    }
+
+private:
+    // drained segments wait here until no thread has them as a hazard. A
+    // consumer may still be moving the last item out when this runs.
+    void retire(segment* s) {
+        std::lock_guard<std::mutex> lock(retire_mutex);
+        retired.push_back(s);
+
+        auto still_used = std::partition(retired.begin(), retired.end(), [](segment* r) {
+            return hazard_table::instance().is_hazardous(r);
+        });
+
+        for(auto it = still_used; it != retired.end(); ++it) delete *it;
+        retired.erase(still_used, retired.end());
+    }
+
+    alignas(64) std::atomic<segment*> head{ nullptr };
+    alignas(64) std::atomic<segment*> tail{ nullptr };
+
+    std::mutex retire_mutex;
+    std::vector<segment*> retired;
+};
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+struct timing_record {
+    const char* name;
+    std::uint64_t ns;
+};
+
+std::atomic<std::uint64_t> dropped_records{ 0 };
+
+// like log_time, but the record goes to a queue drained by another thread.
+// A full queue drops the record instead of blocking the call.
+template<typename Q, typename F>
+constexpr auto log_time_async(Q& queue, const F& func, const char* name) {
+    return [queue = &queue, func, name](auto&&... args) -> decltype(auto) {
+        struct record_on_exit {
+            Q* queue;
+            const char* name;
+            std::uint64_t start = now_ns();
+
+            ~record_on_exit() {
+                if(!queue->try_push(timing_record{ name, now_ns() - start })) {
+                    dropped_records.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        } record{ queue, name };
+
+        return func(std::forward<decltype(args)>(args)...);
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    double cost_per_apple;
+};
+
+////////////////////////////////////
+//    visitor function            //
+////////////////////////////////////
+
+template<typename F>
+constexpr auto visit_apples(F func) {
+    return [func](apples& a, int count, double weight) {
+        return (a.*func)(count, weight);
+    };
+}
+
+////////////////////////////////////
+// final decorated functions      //
+////////////////////////////////////
+
+mpsc_queue<timing_record> timings(4096);
+
+constexpr auto get_cost = log_time_async(timings, visit_apples(&apples::calculate_cost), "get_cost");
+
+////////////////////////////////////
+//     benchmarks                 //
+////////////////////////////////////
+
+// producers push timestamps, consumers sample now - timestamp for latency
+template<typename Q>
+void bench_queue(const char* label, Q& queue, std::size_t producers, std::size_t consumers, std::size_t batch) {
+    const std::size_t total = std::size_t(1) << 20;
+    const std::size_t per_producer = total / producers;
+    std::atomic<std::size_t> consumed{ 0 };
+    std::vector<std::vector<std::uint64_t>> latencies(consumers);
+
+    auto push_one = [&](std::uint64_t value) {
+        unsigned spins = 0;
+        if constexpr(std::is_same<Q, unbounded_queue<std::uint64_t>>::value) {
+            queue.push(value);
+        } else {
+            while(!queue.try_push(value)) cpu_relax(spins);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+
+    for(std::size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&]() {
+            if constexpr(!std::is_same<Q, unbounded_queue<std::uint64_t>>::value) {
+                if(batch > 1) {
+                    std::vector<std::uint64_t> buffer(batch);
+                    for(std::size_t sent = 0; sent < per_producer; ) {
+                        std::size_t want = std::min(batch, per_producer - sent);
+                        std::fill(buffer.begin(), buffer.begin() + want, now_ns());
+
+                        unsigned spins = 0;
+                        std::size_t pushed;
+                        while((pushed = queue.push_batch(buffer.begin(), want)) == 0) cpu_relax(spins);
+                        sent += pushed;
+                    }
+                    return;
+                }
+            }
+
+            for(std::size_t i = 0; i < per_producer; ++i) {
+                push_one(now_ns());
+            }
+        });
+    }
+
+    for(std::size_t c = 0; c < consumers; ++c) {
+        threads.emplace_back([&, c]() {
+            std::vector<std::uint64_t> buffer(std::max<std::size_t>(batch, 1));
+            unsigned spins = 0;
+            std::size_t n = 0;
+
+            while(consumed.load(std::memory_order_relaxed) < per_producer * producers) {
+                std::size_t got = 0;
+                if constexpr(!std::is_same<Q, unbounded_queue<std::uint64_t>>::value) {
+                    got = batch > 1 ? queue.pop_batch(buffer.begin(), batch) : queue.try_pop(buffer[0]);
+                } else {
+                    got = queue.try_pop(buffer[0]);
+                }
+
+                if(!got) {
+                    cpu_relax(spins);
+                    continue;
+                }
+
+                std::uint64_t now = now_ns();
+                for(std::size_t i = 0; i < got; ++i) {
+                    if((n++ & 255) == 0) latencies[c].push_back(now - buffer[i]);
+                }
+                consumed.fetch_add(got, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    for(auto& t : threads) t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<std::uint64_t> all;
+    for(auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double q) { return all.empty() ? 0.0 : all[std::size_t(q * (all.size() - 1))] / 1000.0; };
+
+    std::cout << label << producers << "P/" << consumers << "C: "
+              << consumed.load() / seconds / 1e6 << " Mitems/s, latency p50 "
+              << percentile(0.5) << " us, p99 " << percentile(0.99) << " us" << std::endl;
+}
+
+int main() {
+    std::thread logger([]() {
+        timing_record r;
+        int seen = 0;
+        while(seen < 2) {
+            if(timings.try_pop(r)) {
+                std::cout << r.name << " took " << r.ns << "ns" << std::endl;
+                ++seen;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    apples groceries(1.09);
+    std::cout << "Bag cost $" << get_cost(groceries, 2, 1.1) << std::endl;
+    try {
+        get_cost(groceries, 0, 1.1);
+    } catch(std::exception& e) {
+        std::cout << "There was an error: " << e.what() << std::endl;
+    }
+    logger.join();
+    std::cout << std::endl;
+
+    using item = std::uint64_t;
+    const std::size_t ring = 1024;
+
+    for(auto pc : { std::make_pair(1, 1), std::make_pair(1, 4), std::make_pair(4, 1), std::make_pair(4, 4) }) {
+        mpmc_queue<item> q(ring);
+        bench_queue("mpmc          ", q, pc.first, pc.second, 1);
+    }
+    for(auto pc : { std::make_pair(1, 1), std::make_pair(4, 4) }) {
+        mpmc_queue<item> q(ring);
+        bench_queue("mpmc batch 32 ", q, pc.first, pc.second, 32);
+    }
+    for(int producers : { 1, 4 }) {
+        mpsc_queue<item> q(ring);
+        bench_queue("mpsc          ", q, producers, 1, 1);
+    }
+    {
+        spsc_queue<item> q(ring);
+        bench_queue("spsc          ", q, 1, 1, 1);
+    }
+    {
+        spsc_queue<item> q(ring);
+        bench_queue("spsc batch 32 ", q, 1, 1, 32);
+    }
+    for(auto pc : { std::make_pair(1, 1), std::make_pair(4, 4) }) {
+        unbounded_queue<item> q;
+        bench_queue("unbounded     ", q, pc.first, pc.second, 1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,194 @@
+// decorating recursive functions
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// With the `_impl` naming pattern a recursive implementation calls itself, not
+// the decorated function, so memo/tracing/limits only ever see the outermost
+// call. recursive(decorator) ties the knot Y-combinator style: the
+// implementation takes `self` as its first parameter and `self` *is* the
+// decorated function. No std::function is involved, every layer stays a plain
+// closure the compiler can inline.
+
+#include <iostream>
+#include <memory>
+#include <map>
+#include <tuple>
+#include <typeindex>
+#include <utility>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+#include <cstdint>
+
+using namespace std;
+
+//////////////////////////////////////
+//   fixpoint                       //
+//////////////////////////////////////
+
+// holds the implementation and the decorated chain built around it.
+// The innermost layer calls impl(*this, args...) so recursive calls made
+// through `self` enter the chain from the top again.
+template<typename Impl, typename Decorator>
+struct recursive_fn {
+    struct open {
+        const recursive_fn* self;
+
+        template<typename... Args>
+        decltype(auto) operator()(Args&&... args) const {
+            return self->impl(*self, std::forward<Args>(args)...);
+        }
+    };
+
+    recursive_fn(Impl impl, const Decorator& decorator)
+        : impl(std::move(impl)), decorated(decorator(open{ this })) { }
+
+    // the chain points back at this object, so it must stay put
+    recursive_fn(const recursive_fn&) = delete;
+    recursive_fn& operator=(const recursive_fn&) = delete;
+
+    template<typename... Args>
+    decltype(auto) operator()(Args&&... args) const {
+        return decorated(std::forward<Args>(args)...);
+    }
+
+    Impl impl;
+    decltype(std::declval<const Decorator&>()(std::declval<open>())) decorated;
+};
+
+// recursive(decorator)(impl) where impl is `(auto& self, args...)`
+template<typename Decorator>
+constexpr auto recursive(Decorator decorator) {
+    return [decorator](auto impl) {
+        // C++17 guaranteed elision, the object is built in place
+        return recursive_fn<decltype(impl), Decorator>(std::move(impl), decorator);
+    };
+}
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+// caches results by argument values. The cache is shared by copies of the
+// decorated function and created on first use for each argument signature.
+struct memo_state {
+    std::map<std::type_index, std::shared_ptr<void>> caches;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+};
+
+template<typename F>
+auto memoize(const F& func) {
+    auto state = std::make_shared<memo_state>();
+
+    return [func, state](auto&&... args) {
+        using K = std::tuple<std::decay_t<decltype(args)>...>;
+        using R = std::decay_t<decltype(func(std::forward<decltype(args)>(args)...))>;
+        using cache_type = std::map<K, R>;
+
+        auto& slot = state->caches[std::type_index(typeid(cache_type))];
+        if(!slot) {
+            slot = std::make_shared<cache_type>();
+        }
+
+        auto& cache = *static_cast<cache_type*>(slot.get());
+        K key(args...);
+
+        auto it = cache.find(key);
+        if(it != cache.end()) {
+            ++state->hits;
+            return it->second;
+        }
+
+        ++state->misses;
+        R result = func(std::forward<decltype(args)>(args)...);
+        cache.emplace(std::move(key), result);
+        return result;
+    };
+}
+
+// nesting level of traced/limited calls on this thread
+thread_local int decorated_depth = 0;
+
+struct depth_guard {
+    depth_guard() { ++decorated_depth; }
+    ~depth_guard() { --decorated_depth; }
+};
+
+template<typename F>
+auto trace(const F& func, std::string name) {
+    return [func, name](auto&&... args) {
+        std::cout << std::string(decorated_depth * 2, ' ') << name << "(";
+        const char* sep = "";
+        (void)std::initializer_list<int>{ (std::cout << sep << args, sep = ", ", 0)... };
+        std::cout << ")" << std::endl;
+
+        depth_guard guard;
+        return func(std::forward<decltype(args)>(args)...);
+    };
+}
+
+template<typename F>
+auto limit_depth(int max_depth, const F& func) {
+    return [func, max_depth](auto&&... args) {
+        if(decorated_depth >= max_depth) {
+            throw std::runtime_error("recursion limit of " + std::to_string(max_depth) + " reached");
+        }
+
+        depth_guard guard;
+        return func(std::forward<decltype(args)>(args)...);
+    };
+}
+
+////////////////////////////////////////
+//    function implementations        //
+////////////////////////////////////////
+
+std::uint64_t fib_calls = 0;
+
+// the usual way: recursion bypasses any decorator
+std::uint64_t fib_impl(int n) {
+    ++fib_calls;
+    return n < 2 ? n : fib_impl(n - 1) + fib_impl(n - 2);
+}
+
+// the fixpoint way: recursion goes through `self`
+auto fib_open_impl = [](auto& self, int n) -> std::uint64_t {
+    ++fib_calls;
+    return n < 2 ? n : self(n - 1) + self(n - 2);
+};
+
+auto gcd_open_impl = [](auto& self, int a, int b) -> int {
+    return b == 0 ? a : self(b, a % b);
+};
+
+/////////////////////////////////////////
+// final decorated functions           //
+/////////////////////////////////////////
+
+auto fib_outer_only = memoize(fib_impl);
+auto fib = recursive([](auto f) { return limit_depth(200, memoize(f)); })(fib_open_impl);
+auto gcd = recursive([](auto f) { return trace(f, "gcd"); })(gcd_open_impl);
+
+int main() {
+    fib_calls = 0;
+    std::cout << "memoize(fib_impl)(40) = " << fib_outer_only(40);
+    std::cout << " took " << fib_calls << " calls" << std::endl;
+
+    fib_calls = 0;
+    std::cout << "recursive memoize fib(40) = " << fib(40);
+    std::cout << " took " << fib_calls << " calls" << std::endl;
+
+    fib_calls = 0;
+    std::cout << "fib(90) = " << fib(90) << " took " << fib_calls << " more calls\n" << std::endl;
+
+    int g = gcd(1071, 462);
+    std::cout << "gcd = " << g << "\n" << std::endl;
+
+    try {
+        fib(1000);
+    } catch(std::exception& e) {
+        std::cout << "fib(1000) stopped: " << e.what() << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,363 @@
+// structure-of-arrays results for batched decorated calls
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// better_member_func.cpp collects results as optional_type<double>: a value,
+// two bools and a std::string per call, 48 bytes on a 64-bit build even when
+// nothing failed. result_column<T> stores a batch the other way around:
+//
+//   values    dense array of T, one per call; a failed call leaves T{}
+//   ok bits   one bit per call, set when the call succeeded
+//   errors    (index, message) pairs for the failed calls only, by index
+//
+// A successful call costs sizeof(T) plus one bit. Reductions over the
+// successful values walk the dense array: sum() relies on failed slots
+// holding T{} and runs eight independent accumulators the compiler can keep
+// in vector registers; reduce() skips failed slots a bitmap word at a time.
+//
+// batched(func) turns a per-call decorated function into a batch function
+// that writes straight into a column. The first argument is shared by every
+// call (the apples for visit_apples), the others are columns read together:
+//
+//   batched(exception_fail_safe(visit_apples(&apples::calculate_cost)))
+//       (costs, groceries, counts, weights);
+//
+// exception_fail_safe(batch, func) is the same batch call without a
+// per-row optional_type: rows run inside one try block until one throws, the
+// failing row goes into the error table and the batch resumes after it.
+//
+//   g++ -std=c++17 -O2 result_column.cpp
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+////////////////////////////////////
+//      optional type             //
+////////////////////////////////////
+template<typename T>
+struct optional_type {
+    T value;
+    bool OK;
+    bool BAD;
+    std::string msg;
+
+    optional_type(T&& t) : value(std::move(t)) { OK = true; BAD = false; }
+    optional_type(bool ok, std::string msg="") : msg(std::move(msg)) { OK = ok; BAD = !ok; }
+};
+
+template<typename T>
+struct is_optional_type : std::false_type { };
+
+template<typename T>
+struct is_optional_type<optional_type<T>> : std::true_type { };
+
+//////////////////////////////////////
+//   result column                  //
+//////////////////////////////////////
+
+struct column_error {
+    std::size_t index;
+    std::string msg;
+};
+
+template<typename T>
+class result_column {
+public:
+    // n calls, none successful yet; keeps the capacity of earlier batches
+    void reset(std::size_t n) {
+        values.assign(n, T{});
+        ok_bits.assign((n + 63) / 64, 0);
+        error_table.clear();
+    }
+
+    void set(std::size_t i, T value) {
+        values[i] = std::move(value);
+        ok_bits[i / 64] |= std::uint64_t(1) << (i % 64);
+    }
+
+    // errors are usually recorded in index order, which makes this an append
+    void fail(std::size_t i, std::string msg) {
+        values[i] = T{};
+        ok_bits[i / 64] &= ~(std::uint64_t(1) << (i % 64));
+
+        if(error_table.empty() || error_table.back().index < i) {
+            error_table.push_back(column_error{ i, std::move(msg) });
+            return;
+        }
+
+        auto it = std::lower_bound(error_table.begin(), error_table.end(), i,
+            [](const column_error& e, std::size_t index) { return e.index < index; });
+        if(it != error_table.end() && it->index == i) {
+            it->msg = std::move(msg);
+        } else {
+            error_table.insert(it, column_error{ i, std::move(msg) });
+        }
+    }
+
+    std::size_t size() const { return values.size(); }
+    bool ok(std::size_t i) const { return ok_bits[i / 64] >> (i % 64) & 1; }
+    const T& value(std::size_t i) const { return values[i]; }
+    const T* data() const { return values.data(); }
+
+    const std::vector<column_error>& errors() const { return error_table; }
+    std::size_t error_count() const { return error_table.size(); }
+    std::size_t success_count() const { return size() - error_count(); }
+
+    // empty when call i succeeded
+    const std::string& error(std::size_t i) const {
+        static const std::string none;
+        auto it = std::lower_bound(error_table.begin(), error_table.end(), i,
+            [](const column_error& e, std::size_t index) { return e.index < index; });
+        return it != error_table.end() && it->index == i ? it->msg : none;
+    }
+
+    // one element in the old form, for code that still wants it
+    optional_type<T> get(std::size_t i) const {
+        if(ok(i)) return optional_type<T>(T(values[i]));
+        return optional_type<T>(false, error(i));
+    }
+
+    // sum of the successful values; failed slots hold T{} and add nothing
+    T sum() const {
+        constexpr std::size_t lanes = 8;
+        T acc[lanes] = {};
+
+        const T* v = values.data();
+        std::size_t n = values.size(), i = 0;
+        for(; i + lanes <= n; i += lanes) {
+            for(std::size_t l = 0; l < lanes; ++l) acc[l] += v[i + l];
+        }
+
+        T total{};
+        for(; i < n; ++i) total += v[i];
+        for(std::size_t l = 0; l < lanes; ++l) total += acc[l];
+        return total;
+    }
+
+    // op over the successful values only, 64 calls per bitmap word
+    template<typename Op>
+    T reduce(T init, Op op) const {
+        const T* v = values.data();
+        std::size_t n = values.size();
+
+        for(std::size_t w = 0; w < ok_bits.size(); ++w) {
+            std::uint64_t bits = ok_bits[w];
+            std::size_t base = w * 64;
+
+            if(bits == ~std::uint64_t(0)) {
+                for(std::size_t i = base; i < base + 64; ++i) init = op(init, v[i]);
+                continue;
+            }
+
+            while(bits) {
+                std::size_t i = base + std::size_t(__builtin_ctzll(bits));
+                if(i >= n) break;
+                init = op(init, v[i]);
+                bits &= bits - 1;
+            }
+        }
+
+        return init;
+    }
+
+private:
+    std::vector<T> values;
+    std::vector<std::uint64_t> ok_bits;
+    std::vector<column_error> error_table;
+};
+
+/////////////////////////////////////
+//          decorators             //
+/////////////////////////////////////
+
+template<typename F>
+constexpr auto exception_fail_safe(const F& func)  {
+    return [func](auto&&... args)
+    -> optional_type<decltype(func(std::forward<decltype(args)>(args)...))> {
+        using R = optional_type<decltype(func(std::forward<decltype(args)>(args)...))>;
+
+        try {
+            return R(func(std::forward<decltype(args)>(args)...));
+        } catch(std::iostream::failure& e) {
+            return R(false, e.what());
+        } catch(std::exception& e) {
+            return R(false, e.what());
+        } catch(...) {
+            // This ... catch clause will capture any exception thrown
+            return R(false, std::string("Exception caught: default exception"));
+        }
+    };
+}
+
+// the batch form: exception_fail_safe(batch, func) writes into a result_column.
+// One try region covers every row up to the next failure; the catch records
+// the failing row and the loop resumes at the row after it. A successful row
+// builds no optional_type and no message string.
+struct batch_tag { };
+inline constexpr batch_tag batch{};
+
+template<typename F>
+constexpr auto exception_fail_safe(batch_tag, const F& func) {
+    return [func](auto& out, auto&& shared, const auto&... columns) -> decltype(out) {
+        std::size_t n = std::min({ columns.size()... });
+        out.reset(n);
+
+        std::size_t i = 0;
+        while(i < n) {
+            try {
+                for(; i < n; ++i) {
+                    out.set(i, func(shared, columns[i]...));
+                }
+            } catch(std::iostream::failure& e) {
+                out.fail(i++, e.what());
+            } catch(std::exception& e) {
+                out.fail(i++, e.what());
+            } catch(...) {
+                out.fail(i++, std::string("Exception caught: default exception"));
+            }
+        }
+
+        return out;
+    };
+}
+
+// calls func once per row and writes each result into `out`.
+// optional_type results are unpacked into the bitmap and error table.
+template<typename F>
+constexpr auto batched(const F& func) {
+    return [func](auto& out, auto&& shared, const auto&... columns) -> decltype(out) {
+        std::size_t n = std::min({ columns.size()... });
+        out.reset(n);
+
+        for(std::size_t i = 0; i < n; ++i) {
+            auto r = func(shared, columns[i]...);
+
+            if constexpr(is_optional_type<decltype(r)>::value) {
+                if(r.OK) {
+                    out.set(i, std::move(r.value));
+                } else {
+                    out.fail(i, std::move(r.msg));
+                }
+            } else {
+                out.set(i, std::move(r));
+            }
+        }
+
+        return out;
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    double cost_per_apple;
+};
+
+////////////////////////////////////
+//    visitor function            //
+////////////////////////////////////
+
+template<typename F>
+constexpr auto visit_apples(const F& func) {
+    return [func](apples& a, auto&&... args) {
+        return (a.*func)(std::forward<decltype(args)>(args)...);
+    };
+}
+
+///////////////////////////////
+// final decorated functions //
+///////////////////////////////
+
+constexpr auto get_cost = exception_fail_safe(visit_apples(&apples::calculate_cost));
+constexpr auto get_costs = batched(get_cost);
+constexpr auto get_costs_resumable = exception_fail_safe(batch, visit_apples(&apples::calculate_cost));
+
+int main() {
+    apples groceries(1.09);
+
+    // the three orders from better_member_func.cpp, as columns
+    std::vector<int> counts{ 2, 5, 4 };
+    std::vector<double> weights{ 1.1, 1.3, 0 };
+
+    result_column<double> costs;
+    get_costs_resumable(costs, groceries, counts, weights);
+
+    for(std::size_t i = 0; i < costs.size(); ++i) {
+        if(costs.ok(i)) {
+            std::cout << "Bag cost $" << costs.value(i) << std::endl;
+        } else {
+            std::cout << "There was an error: " << costs.error(i) << std::endl;
+        }
+    }
+    std::cout << "total $" << costs.sum() << " over " << costs.success_count() << " bags\n" << std::endl;
+
+    // a large batch with one failing order in a thousand
+    const std::size_t n = 1000000;
+    counts.resize(n);
+    weights.resize(n);
+    for(std::size_t i = 0; i < n; ++i) {
+        counts[i] = i % 1000 == 999 ? 0 : int(i % 12) + 1;
+        weights[i] = 0.5 + double(i % 7) * 0.25;
+    }
+
+    auto time_ms = [](auto&& work) {
+        auto start = std::chrono::steady_clock::now();
+        work();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::vector<optional_type<double>> rows;
+    rows.reserve(n);
+    double row_total = 0;
+
+    double row_fill = time_ms([&]() {
+        for(std::size_t i = 0; i < n; ++i) rows.push_back(get_cost(groceries, counts[i], weights[i]));
+    });
+    double row_sum = time_ms([&]() {
+        for(const auto& r : rows) if(r.OK) row_total += r.value;
+    });
+
+    double column_total = 0, column_max = 0;
+    double column_fill = time_ms([&]() { get_costs(costs, groceries, counts, weights); });
+    double column_sum = time_ms([&]() { column_total = costs.sum(); });
+    double column_reduce = time_ms([&]() {
+        column_max = costs.reduce(0.0, [](double a, double b) { return std::max(a, b); });
+    });
+
+    double resumable_fill = time_ms([&]() { get_costs_resumable(costs, groceries, counts, weights); });
+
+    std::cout << n << " orders, " << costs.error_count() << " failed\n"
+              << "  rows of optional_type: " << sizeof(optional_type<double>) << " bytes/order, fill "
+              << row_fill << " ms, sum " << row_sum << " ms (total " << row_total << ")\n"
+              << "  result_column:         " << sizeof(double) << " bytes + 1 bit/order, fill "
+              << column_fill << " ms, sum " << column_sum << " ms (total " << column_total << ")\n"
+              << "  batch fail-safe:       fill " << resumable_fill << " ms, first error at order "
+              << costs.errors().front().index << ": " << costs.errors().front().msg << "\n"
+              << "  max over successes:    " << column_reduce << " ms (" << column_max << ")" << std::endl;
+
+    return 0;
+}
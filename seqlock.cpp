@@ -0,0 +1,310 @@
+// seqlock-protected member decorators for read-mostly objects
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// Many threads price bags with apples::calculate_cost while a rare updater
+// changes cost_per_apple. A reader lock would make every reader write the
+// lock's cache line. Instead the object lives in a seqlocked<T> next to a
+// sequence counter.
+//
+// optimistic_read(&T::member) copies the object out, checks that no write
+// overlapped the copy (retrying if one did) and calls the member function on
+// the private copy. Readers never store to shared memory.
+//
+// exclusive_write(&T::member) serializes writers, runs the member function on
+// a copy and publishes the copy between two increments of the counter. If
+// the member function throws, nothing is published.
+//
+// Both sides touch the shared bytes only through relaxed atomic word
+// accesses, so overlapping reads and writes are not data races (Boehm,
+// "Can Seqlocks Get Along With Programming Language Memory Models?").
+// T must be trivially copyable.
+//
+//   g++ -std=c++17 -O2 -pthread seqlock.cpp
+
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+using namespace std;
+
+//////////////////////////////////////
+//   seqlocked object               //
+//////////////////////////////////////
+
+// read retries caused by overlapping writes (diagnostics only). Counted per
+// thread so readers never write shared memory; a thread's count is added
+// to the total when it exits.
+std::atomic<std::uint64_t> exited_thread_retries{ 0 };
+
+inline std::uint64_t& this_thread_retries() {
+    thread_local struct counter {
+        std::uint64_t n = 0;
+        ~counter() { exited_thread_retries.fetch_add(n, std::memory_order_relaxed); }
+    } retries;
+    return retries.n;
+}
+
+// every exited thread's retries plus the calling thread's
+inline std::uint64_t seqlock_read_retries() {
+    return exited_thread_retries.load(std::memory_order_relaxed) + this_thread_retries();
+}
+
+template<typename T>
+class seqlocked {
+    static_assert(std::is_trivially_copyable<T>::value, "seqlocked<T> copies T word by word");
+
+    static constexpr std::size_t word_count = (sizeof(T) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+
+public:
+    explicit seqlocked(const T& initial) { store_words(initial); }
+
+    // a consistent copy; spins while a write is in progress
+    T load() const {
+        for(;;) {
+            std::uint64_t before = sequence.load(std::memory_order_acquire);
+
+            if(before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            T copy = load_words();
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if(sequence.load(std::memory_order_relaxed) == before) {
+                return copy;
+            }
+
+            ++this_thread_retries();
+        }
+    }
+
+    // runs f on a copy of the object and publishes the copy if f returns.
+    // A throwing f leaves the shared object untouched.
+    template<typename F>
+    auto update(F&& f) {
+        std::lock_guard<std::mutex> lock(writer);
+        T copy = load_words();
+
+        if constexpr(std::is_void<decltype(f(copy))>::value) {
+            f(copy);
+            publish(copy);
+        } else {
+            auto result = f(copy);
+            publish(copy);
+            return result;
+        }
+    }
+
+private:
+    void publish(const T& value) {
+        std::uint64_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        store_words(value);
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    T load_words() const {
+        std::uint64_t buffer[word_count];
+        for(std::size_t i = 0; i < word_count; ++i) {
+            buffer[i] = words[i].load(std::memory_order_relaxed);
+        }
+
+        // memcpy into raw storage implicitly creates the T (P0593)
+        alignas(T) unsigned char out[sizeof(T)];
+        std::memcpy(out, buffer, sizeof(T));
+        return *std::launder(reinterpret_cast<T*>(out));
+    }
+
+    void store_words(const T& value) {
+        std::uint64_t buffer[word_count] = {};
+        std::memcpy(buffer, &value, sizeof(T));
+
+        for(std::size_t i = 0; i < word_count; ++i) {
+            words[i].store(buffer[i], std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<std::uint64_t> sequence{ 0 };
+    std::atomic<std::uint64_t> words[word_count];
+    std::mutex writer;
+};
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+// only const members: optimistic_read calls them on a throwaway copy
+template<typename M>
+struct is_const_member : std::false_type { };
+
+template<typename R, typename C, typename... Args>
+struct is_const_member<R (C::*)(Args...) const> : std::true_type { };
+
+template<typename R, typename C, typename... Args>
+struct is_const_member<R (C::*)(Args...) const noexcept> : std::true_type { };
+
+template<typename R, typename C, typename... Args>
+struct is_const_member<R (C::*)(Args...) const&> : std::true_type { };
+
+template<typename R, typename C, typename... Args>
+struct is_const_member<R (C::*)(Args...) const& noexcept> : std::true_type { };
+
+template<typename M>
+constexpr auto optimistic_read(M member) {
+    static_assert(is_const_member<M>::value,
+                  "optimistic_read runs the member on a copy; changes would be lost, use exclusive_write");
+
+    return [member](const auto& obj, auto&&... args) -> decltype(auto) {
+        auto copy = obj.load();
+        return (copy.*member)(std::forward<decltype(args)>(args)...);
+    };
+}
+
+template<typename M>
+constexpr auto exclusive_write(M member) {
+    return [member](auto& obj, auto&&... args) -> decltype(auto) {
+        return obj.update([&](auto& copy) -> decltype(auto) {
+            return (copy.*member)(std::forward<decltype(args)>(args)...);
+        });
+    };
+}
+
+// the reader/writer lock alternative for the benchmark
+template<typename T>
+struct rw_locked {
+    explicit rw_locked(const T& initial) : value(initial) { }
+
+    T value;
+    mutable std::shared_mutex mutex;
+};
+
+template<typename M>
+constexpr auto shared_read(M member) {
+    return [member](const auto& obj, auto&&... args) {
+        std::shared_lock<std::shared_mutex> lock(obj.mutex);
+        auto copy = obj.value;
+        return (copy.*member)(std::forward<decltype(args)>(args)...);
+    };
+}
+
+template<typename M>
+constexpr auto unique_write(M member) {
+    return [member](auto& obj, auto&&... args) {
+        std::unique_lock<std::shared_mutex> lock(obj.mutex);
+        return (obj.value.*member)(std::forward<decltype(args)>(args)...);
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) const {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    // the rare update
+    void set_price(double price) {
+        if(price <= 0)
+            throw std::runtime_error("price must be positive");
+
+        cost_per_apple = price;
+        price_changes++;
+    }
+
+    double cost_per_apple;
+    long price_changes = 0;
+};
+
+////////////////////////////////////
+// final decorated functions      //
+////////////////////////////////////
+
+constexpr auto get_cost = optimistic_read(&apples::calculate_cost);
+constexpr auto set_price = exclusive_write(&apples::set_price);
+
+constexpr auto get_cost_rw = shared_read(&apples::calculate_cost);
+constexpr auto set_price_rw = unique_write(&apples::set_price);
+
+int main() {
+    seqlocked<apples> stand(apples(1.09));
+
+    std::cout << "Bag cost $" << get_cost(stand, 2, 1.1) << std::endl;
+    set_price(stand, 2.0);
+    std::cout << "Bag cost $" << get_cost(stand, 2, 1.1) << std::endl;
+
+    try {
+        set_price(stand, -1.0);
+    } catch(std::exception& e) {
+        std::cout << "There was an error: " << e.what() << "\n" << std::endl;
+    }
+
+    // readers hammer the object while one writer changes the price
+    auto bench = [](const char* label, auto& obj, const auto& read, const auto& write, std::size_t readers) {
+        const int per_reader = 1000000;
+        std::atomic<bool> stop{ false };
+
+        std::thread writer([&]() {
+            double price = 1.0;
+            while(!stop.load()) {
+                write(obj, price += 0.01);
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(std::size_t t = 0; t < readers; ++t) {
+            threads.emplace_back([&]() {
+                double sum = 0;
+                for(int i = 0; i < per_reader; ++i) {
+                    sum += read(obj, 1 + (i & 3), 1.1);
+                }
+                if(sum < 0) std::cout << sum;
+            });
+        }
+        for(auto& t : threads) t.join();
+        auto end = std::chrono::steady_clock::now();
+
+        stop = true;
+        writer.join();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        std::cout << label << readers << " readers: " << readers * per_reader / seconds / 1e6 << " Mreads/s" << std::endl;
+    };
+
+    std::size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    for(std::size_t readers = 1; readers <= std::max<std::size_t>(hw, 4); readers *= 2) {
+        rw_locked<apples> locked(apples(1.09));
+        seqlocked<apples> optimistic(apples(1.09));
+        std::uint64_t retries_before = seqlock_read_retries();
+
+        bench("shared_mutex ", locked, get_cost_rw, set_price_rw, readers);
+        bench("seqlock      ", optimistic, get_cost, set_price, readers);
+        std::cout << "  (" << seqlock_read_retries() - retries_before << " seqlock read retries)" << std::endl;
+    }
+
+    return 0;
+}
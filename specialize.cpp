@@ -0,0 +1,263 @@
+// value-profile-guided specialization of decorated functions
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// specialize_on<I>(values<...>{}, func) checks argument I against a short list
+// of values seen often in production (see hot_keys.cpp). A match calls func
+// with that argument replaced by a compile-time constant so the optimizer can
+// fold it into a dedicated copy of the inlined body; anything else falls back
+// to the generic call.
+//
+// Floating point template arguments need C++20:
+//   g++ -std=c++20 -O2 specialize.cpp
+//
+// The same binary turns hot_keys output into the specialization list:
+//   ./hot_keys | ./specialize --emit 2 get_cost
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <utility>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+//////////////////////////////////////
+//   compile-time values            //
+//////////////////////////////////////
+
+// the list of values we want dedicated code for
+template<auto... V>
+struct values { };
+
+// an argument whose value is part of its type
+template<auto V>
+struct constant {
+    using value_type = decltype(V);
+    static constexpr value_type value = V;
+    constexpr operator value_type() const { return V; }
+};
+
+// argument J of the call, or the constant if J is the specialized position
+template<bool Replace, auto V, typename Arg>
+constexpr decltype(auto) pick(Arg&& arg) {
+    if constexpr(Replace) {
+        return constant<V>{};
+    } else {
+        return std::forward<Arg>(arg);
+    }
+}
+
+template<std::size_t I, auto V, typename F, typename Tuple, std::size_t... J>
+decltype(auto) call_specialized(const F& func, Tuple&& args, std::index_sequence<J...>) {
+    return func(pick<I == J, V>(std::get<J>(std::move(args)))...);
+}
+
+// the compare chain: one branch per hot value, generic call last
+template<std::size_t I, auto V, auto... Rest, typename F, typename Tuple>
+decltype(auto) dispatch(const F& func, Tuple&& args) {
+    constexpr auto N = std::tuple_size<std::decay_t<Tuple>>::value;
+
+    if(std::get<I>(args) == V) {
+        return call_specialized<I, V>(func, std::move(args), std::make_index_sequence<N>());
+    }
+
+    if constexpr(sizeof...(Rest) > 0) {
+        return dispatch<I, Rest...>(func, std::move(args));
+    } else {
+        return std::apply(func, std::move(args));
+    }
+}
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+template<std::size_t I, auto... V, typename F>
+constexpr auto specialize_on(values<V...>, const F& func) {
+    static_assert(sizeof...(V) > 0, "specialize_on needs at least one observed value");
+
+    return [func](auto&&... args) -> decltype(auto) {
+        static_assert(I < sizeof...(args), "specialized argument index out of range");
+        return dispatch<I, V...>(func, std::forward_as_tuple(std::forward<decltype(args)>(args)...));
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    // heavier bags get a bulk discount
+    double bulk_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*std::pow(weight, 0.8)*cost_per_apple;
+    }
+
+    double cost_per_apple;
+};
+
+////////////////////////////////////
+//    visitor function            //
+////////////////////////////////////
+
+template<typename F>
+constexpr auto visit_apples(F func) {
+    return [func](apples& a, auto&&... args) {
+        return (a.*func)(std::forward<decltype(args)>(args)...);
+    };
+}
+
+////////////////////////////////////
+// final decorated functions      //
+////////////////////////////////////
+
+// list produced by: ./hot_keys | ./specialize --emit 2 get_cost
+constexpr auto get_cost = specialize_on<2>(values<1.1, 4.25>{}, visit_apples(&apples::calculate_cost));
+constexpr auto get_cost_generic = visit_apples(&apples::calculate_cost);
+
+// Folding needs the callee inlined. visit_apples calls through a captured
+// member pointer; GCC -O2 turns that into a direct call, but too late to
+// inline calculate_cost, so the constant saves nothing there and the extra
+// compares cost a little. Here the callee is named directly, it inlines and
+// pow(1.1, 0.8) folds to a constant.
+constexpr auto bulk_cost = [](apples& a, int count, double weight) { return a.bulk_cost(count, weight); };
+constexpr auto get_bulk_cost = specialize_on<2>(values<1.1, 4.25>{}, bulk_cost);
+
+//////////////////////////////////////
+//   hot_keys output -> values<>    //
+//////////////////////////////////////
+
+// splits the args label "(a, b, c)" of a hot_key_calls sample
+std::vector<std::string> split_args(const std::string& tuple) {
+    std::vector<std::string> out;
+    std::string inner = tuple.substr(1, tuple.size() - 2);
+    std::size_t start = 0;
+
+    while(start <= inner.size()) {
+        std::size_t comma = inner.find(", ", start);
+        if(comma == std::string::npos) comma = inner.size();
+        out.push_back(inner.substr(start, comma - start));
+        start = comma + 2;
+    }
+
+    return out;
+}
+
+std::string label(const std::string& labels, const std::string& key) {
+    std::string needle = key + "=\"";
+    std::size_t at = labels.find(needle);
+    if(at == std::string::npos) return "";
+
+    at += needle.size();
+    return labels.substr(at, labels.find('"', at) - at);
+}
+
+// reads `hot_key_calls{fn=...,args="(...)"} count` lines, sums the calls per
+// value of argument `index` and prints the values covering at least
+// `min_share` of the calls as a values<...> list
+int emit_specialization_list(std::istream& in, std::size_t index, const std::string& fn, double min_share) {
+    std::map<std::string, double> calls;
+    double total = 0;
+    std::string line;
+
+    while(std::getline(in, line)) {
+        if(line.compare(0, 14, "hot_key_calls{") != 0) continue;
+
+        std::size_t close = line.rfind("} ");
+        if(close == std::string::npos) continue;
+
+        std::string labels = line.substr(14, close - 14);
+        if(label(labels, "fn") != fn) continue;
+
+        auto args = split_args(label(labels, "args"));
+        if(index >= args.size()) {
+            std::cerr << "argument " << index << " out of range for " << fn << std::endl;
+            return 1;
+        }
+
+        double count = std::atof(line.c_str() + close + 2);
+        calls[args[index]] += count;
+        total += count;
+    }
+
+    if(total == 0) {
+        std::cerr << "no hot_key_calls samples for " << fn << std::endl;
+        return 1;
+    }
+
+    std::vector<std::pair<std::string, double>> ranked(calls.begin(), calls.end());
+    std::sort(ranked.begin(), ranked.end(),
+        [](const auto& a, const auto& b) { return a.second > b.second; });
+
+    std::cout << "specialize_on<" << index << ">(values<";
+    bool first = true;
+    for(auto& r : ranked) {
+        if(r.second / total < min_share) break;
+        std::cout << (first ? "" : ", ") << r.first;
+        first = false;
+    }
+    std::cout << ">{}, ...)  // " << fn << std::endl;
+
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if(argc >= 4 && std::strcmp(argv[1], "--emit") == 0) {
+        double min_share = argc >= 5 ? std::atof(argv[4]) : 0.05;
+        return emit_specialization_list(std::cin, std::strtoul(argv[2], nullptr, 10), argv[3], min_share);
+    }
+
+    apples groceries(1.09);
+
+    std::cout << "hot value:  " << get_cost(groceries, 5, 1.1) << std::endl;
+    std::cout << "cold value: " << get_cost(groceries, 5, 2.0) << std::endl;
+
+    // same skewed traffic through both versions
+    const int calls = 20000000;
+    auto run = [&groceries](const auto& f) {
+        double sum = 0;
+        unsigned seed = 1;
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < calls; ++i) {
+            seed = seed * 1664525u + 1013904223u;
+            double weight = (seed >> 24) < 200 ? 1.1 : 4.25;
+            sum += f(groceries, 1 + (i & 3), weight);
+        }
+        auto end = std::chrono::steady_clock::now();
+        std::cout << std::chrono::duration<double, std::nano>(end - start).count() / calls
+                  << " ns/call (checksum " << sum << ")" << std::endl;
+    };
+
+    std::cout << "\ncalculate_cost generic:     "; run(get_cost_generic);
+    std::cout << "calculate_cost specialized: "; run(get_cost);
+    std::cout << "bulk_cost generic:          "; run(bulk_cost);
+    std::cout << "bulk_cost specialized:      "; run(get_bulk_cost);
+
+    return 0;
+}
@@ -0,0 +1,291 @@
+// runtime-patchable switches for decorator layers
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// Checking a global `bool` to skip a disabled layer still costs a load and a
+// branch on every call. switchable<key>(decorator, func) puts a 5-byte
+// instruction at the branch instead, the same trick as the Linux kernel's
+// static keys: a nop while the layer is off, a jmp into the decorated path
+// while it is on. Toggling the key rewrites those instructions in place.
+//
+// Every site starts as a jmp to a plain flag check, which is always correct.
+// At startup the sites are patched to nops, but only if the process is
+// allowed to write its own code pages. Where it is not (W^X policies, other
+// architectures, -DDECORATORS_STATIC_KEYS=0), the flag check simply stays.
+//
+// enable() and disable() rewrite live code with a plain store: no int3
+// breakpoint step and no core serialization, which is what the kernel's
+// text_poke_bp does for cross-modifying code. Only toggle a key while no
+// other thread can be running one of its sites, e.g. during startup before
+// the worker threads exist or while they are parked. The flag-check fallback
+// has no such restriction.
+//
+//   g++ -std=c++17 -O2 static_keys.cpp
+
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+
+#ifndef DECORATORS_STATIC_KEYS
+    #if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__)
+        #define DECORATORS_STATIC_KEYS 1
+    #else
+        #define DECORATORS_STATIC_KEYS 0
+    #endif
+#endif
+
+#if DECORATORS_STATIC_KEYS
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+//////////////////////////////////////
+//   static keys                    //
+//////////////////////////////////////
+
+struct static_key {
+    std::atomic<bool> enabled{ false };
+
+    void enable() { set(true); }
+    void disable() { set(false); }
+
+private:
+    void set(bool on);
+};
+
+#if DECORATORS_STATIC_KEYS
+
+// one entry per branch site, emitted by static_branch() below
+struct jump_entry {
+    unsigned char* code;
+    unsigned char* on_target;
+    unsigned char* check_target;
+    static_key* key;
+};
+
+extern "C" jump_entry __start_decorator_jump_table[];
+extern "C" jump_entry __stop_decorator_jump_table[];
+
+// the 8-byte aligned site holds a 5-byte nop, jmp to the decorated path,
+// or jmp to the flag check
+template<static_key& Key>
+__attribute__((always_inline)) inline bool static_branch() {
+    asm goto(
+        ".p2align 3\n"
+        "1: .byte 0xe9\n"
+        ".long %l[check] - (1b + 5)\n"
+        ".pushsection decorator_jump_table, \"aw\"\n"
+        ".balign 8\n"
+        ".quad 1b, %l[on], %l[check], %c0\n"
+        ".popsection\n"
+        :: "i"(&Key) :: on, check);
+    return false;
+on:
+    return true;
+check:
+    return Key.enabled.load(std::memory_order_relaxed);
+}
+
+namespace jump_labels {
+    std::mutex mutex;
+    bool patchable = false;
+
+    // sites are 8-byte aligned so one atomic store rewrites the instruction
+    bool patch(unsigned char* site, const unsigned char (&insn)[5]) {
+        static const std::uintptr_t page = std::uintptr_t(sysconf(_SC_PAGESIZE));
+        std::uintptr_t first = std::uintptr_t(site) & ~(page - 1);
+        std::size_t length = std::uintptr_t(site) + 8 - first;
+
+        if(mprotect(reinterpret_cast<void*>(first), length, PROT_READ | PROT_WRITE | PROT_EXEC) != 0) {
+            return false;
+        }
+
+        auto* word = reinterpret_cast<std::uint64_t*>(site);
+        std::uint64_t value = __atomic_load_n(word, __ATOMIC_RELAXED);
+        std::memcpy(&value, insn, sizeof(insn));
+        __atomic_store_n(word, value, __ATOMIC_SEQ_CST);
+
+        mprotect(reinterpret_cast<void*>(first), length, PROT_READ | PROT_EXEC);
+        __builtin___clear_cache(reinterpret_cast<char*>(site), reinterpret_cast<char*>(site + 8));
+        return true;
+    }
+
+    bool jump(jump_entry& e, unsigned char* target) {
+        unsigned char jmp[5] = { 0xe9 };
+        std::int32_t rel = std::int32_t(target - (e.code + 5));
+        std::memcpy(jmp + 1, &rel, sizeof(rel));
+        return patch(e.code, jmp);
+    }
+
+    bool point(jump_entry& e, bool on) {
+        static const unsigned char nop5[5] = { 0x0f, 0x1f, 0x44, 0x00, 0x00 };
+
+        if(!on) {
+            return patch(e.code, nop5);
+        }
+
+        return jump(e, e.on_target);
+    }
+
+    // a site failed to patch: every site goes back to the flag check, so
+    // they all keep following set() through the flag from now on
+    bool fall_back() {
+        for(jump_entry* e = __start_decorator_jump_table; e != __stop_decorator_jump_table; ++e) {
+            jump(*e, e->check_target);
+        }
+        return patchable = false;
+    }
+
+    // runs once at startup: replace the flag checks with nops/jmps if we can
+    bool init() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for(jump_entry* e = __start_decorator_jump_table; e != __stop_decorator_jump_table; ++e) {
+            if(!point(*e, e->key->enabled.load())) return fall_back();
+        }
+
+        return patchable = true;
+    }
+
+    const bool initialized = init();
+}
+
+void static_key::set(bool on) {
+    std::lock_guard<std::mutex> lock(jump_labels::mutex);
+    enabled.store(on, std::memory_order_relaxed);
+
+    if(!jump_labels::patchable) return;
+
+    for(jump_entry* e = __start_decorator_jump_table; e != __stop_decorator_jump_table; ++e) {
+        if(e->key == this && !jump_labels::point(*e, on)) {
+            jump_labels::fall_back();
+            return;
+        }
+    }
+}
+
+#else
+
+template<static_key& Key>
+inline bool static_branch() {
+    return Key.enabled.load(std::memory_order_relaxed);
+}
+
+void static_key::set(bool on) {
+    enabled.store(on, std::memory_order_relaxed);
+}
+
+#endif
+
+/////////////////////////
+// decorators          //
+/////////////////////////
+
+template<typename F>
+constexpr auto stars(const F& func) {
+    return [func](auto&&... args) {
+        cout << "*******" << endl;
+        func(forward<decltype(args)>(args)...);
+        cout << "\n*******" << endl;
+    };
+}
+
+// calls decorator(func) while Key is enabled and func alone otherwise.
+// Both must return the same type.
+template<static_key& Key, typename D, typename F>
+constexpr auto switchable(const D& decorator, const F& func) {
+    return [on = decorator(func), func](auto&&... args) -> decltype(auto) {
+        if(static_branch<Key>()) {
+            return on(forward<decltype(args)>(args)...);
+        }
+
+        return func(forward<decltype(args)>(args)...);
+    };
+}
+
+// a counting layer for the benchmark so the work is not optimized away
+unsigned long counted = 0;
+
+template<typename F>
+constexpr auto count(const F& func) {
+    return [func](auto&&... args) {
+        ++counted;
+        return func(forward<decltype(args)>(args)...);
+    };
+}
+
+////////////////////////////////////////
+//    function implementations        //
+////////////////////////////////////////
+
+void hello_impl() {
+   cout << "hello, world!";
+}
+
+// kept out of line so both benchmark variants make the same call
+__attribute__((noinline)) int add_impl(int a, int b) {
+    return a + b;
+}
+
+/////////////////////////////////////////
+// final decorated functions           //
+/////////////////////////////////////////
+
+static_key stars_key;
+static_key count_key;
+std::atomic<bool> count_flag{ false };
+
+constexpr auto hello = switchable<stars_key>([](auto f) { return stars(f); }, hello_impl);
+constexpr auto add = switchable<count_key>([](auto f) { return count(f); }, add_impl);
+
+// the same switch done with a flag, for comparison
+constexpr auto add_flag = [](int a, int b) {
+    if(count_flag.load(std::memory_order_relaxed)) {
+        return count(add_impl)(a, b);
+    }
+
+    return add_impl(a, b);
+};
+
+int main() {
+#if DECORATORS_STATIC_KEYS
+    std::cout << "code patching " << (jump_labels::patchable ? "enabled" : "unavailable, using flag checks") << "\n" << std::endl;
+#endif
+
+    hello();
+    std::cout << std::endl;
+
+    stars_key.enable();
+    hello();
+
+    stars_key.disable();
+    hello();
+    std::cout << "\n" << std::endl;
+
+    auto bench = [](const char* label, const auto& f) {
+        const int calls = 100000000;
+        int sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < calls; ++i) {
+            sum = f(sum, i);
+        }
+        auto end = std::chrono::steady_clock::now();
+        std::cout << label << std::chrono::duration<double, std::nano>(end - start).count() / calls
+                  << " ns/call (checksum " << sum << ")" << std::endl;
+    };
+
+    bench("disabled, flag:        ", add_flag);
+    bench("disabled, static key:  ", add);
+
+    count_flag = true;
+    count_key.enable();
+    bench("enabled, flag:         ", add_flag);
+    bench("enabled, static key:   ", add);
+    std::cout << "counted " << counted << " calls" << std::endl;
+
+    return 0;
+}
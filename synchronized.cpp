@@ -0,0 +1,460 @@
+// synchronized decorator with pluggable, self-profiling locks
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// synchronized(lock, func) runs func while holding `lock`. The lock type is
+// the policy: spin_lock (test-and-test-and-set with pause and exponential
+// backoff), futex_mutex (Drepper's three-state futex mutex), ticket_lock
+// (FIFO) and rw_lock (use synchronized_shared for the read side).
+//
+// Every lock keeps its own statistics: acquisitions, how many of those had
+// to wait, total/max wait time and total hold time. They are published
+// through the metrics registry (see hot_keys.cpp) under the lock's name, so
+// the right lock for a decorated function can be picked from data.
+//
+// Like the stateful decorators in constinit.cpp, the lock is declared next to
+// the decorated function and the decorator stores its address, so several
+// functions can share one lock.
+//
+//   g++ -std=c++17 -O2 -pthread synchronized.cpp
+
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <functional>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+#include <cstdint>
+
+#if defined(__linux__)
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+//////////////////////////////////////
+//      metrics registry            //
+//////////////////////////////////////
+
+// a sample is one line of a prometheus-like text scrape
+struct metric_sample {
+    std::string name;
+    std::string labels;
+    double value;
+};
+
+// collectors are asked for their samples whenever the registry is scraped
+struct metrics_registry {
+    using collector = std::function<void(std::vector<metric_sample>&)>;
+
+    static metrics_registry& instance() {
+        static metrics_registry registry;
+        return registry;
+    }
+
+    // the id removes the collector again, for objects that do not live forever
+    std::size_t add_collector(collector c) {
+        std::lock_guard<std::mutex> lock(mutex);
+        collectors.emplace_back(++last_id, std::move(c));
+        return last_id;
+    }
+
+    void remove_collector(std::size_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        collectors.erase(std::remove_if(collectors.begin(), collectors.end(),
+            [id](const auto& c) { return c.first == id; }), collectors.end());
+    }
+
+    std::vector<metric_sample> scrape() {
+        std::vector<metric_sample> samples;
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto& c : collectors) {
+            c.second(samples);
+        }
+        return samples;
+    }
+
+    void print(std::ostream& os) {
+        for(auto& s : scrape()) {
+            os << s.name << "{" << s.labels << "} " << s.value << "\n";
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::pair<std::size_t, collector>> collectors;
+    std::size_t last_id = 0;
+};
+
+//////////////////////////////////////
+//   lock statistics                //
+//////////////////////////////////////
+
+inline void cpu_pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+inline std::uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct lock_stats {
+    std::atomic<std::uint64_t> acquisitions{ 0 };
+    std::atomic<std::uint64_t> contended{ 0 };
+    std::atomic<std::uint64_t> wait_ns{ 0 };
+    std::atomic<std::uint64_t> max_wait_ns{ 0 };
+    std::atomic<std::uint64_t> hold_ns{ 0 };
+
+    void waited(std::uint64_t ns) {
+        wait_ns.fetch_add(ns, std::memory_order_relaxed);
+
+        std::uint64_t max = max_wait_ns.load(std::memory_order_relaxed);
+        while(ns > max && !max_wait_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) { }
+    }
+};
+
+// base of every lock policy: a name, the stats and their registration
+class profiled_lock {
+public:
+    explicit profiled_lock(std::string name) : name(std::move(name)) {
+        collector_id = metrics_registry::instance().add_collector([this](std::vector<metric_sample>& out) {
+            std::string labels = "lock=\"" + this->name + "\"";
+            out.push_back(metric_sample{ "lock_acquisitions", labels, double(stats.acquisitions) });
+            out.push_back(metric_sample{ "lock_contended", labels, double(stats.contended) });
+            out.push_back(metric_sample{ "lock_wait_ns_total", labels, double(stats.wait_ns) });
+            out.push_back(metric_sample{ "lock_wait_ns_max", labels, double(stats.max_wait_ns) });
+            out.push_back(metric_sample{ "lock_hold_ns_total", labels, double(stats.hold_ns) });
+        });
+    }
+
+    ~profiled_lock() {
+        metrics_registry::instance().remove_collector(collector_id);
+    }
+
+    // registered by address, so locks stay where they are declared
+    profiled_lock(const profiled_lock&) = delete;
+    profiled_lock& operator=(const profiled_lock&) = delete;
+
+    std::string name;
+    lock_stats stats;
+
+private:
+    std::size_t collector_id;
+};
+
+//////////////////////////////////////
+//   lock policies                  //
+//////////////////////////////////////
+
+class spin_lock : public profiled_lock {
+public:
+    using profiled_lock::profiled_lock;
+
+    bool try_lock() {
+        return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void lock() {
+        unsigned backoff = 1;
+        while(!try_lock()) {
+            for(unsigned i = 0; i < backoff; ++i) cpu_pause();
+
+            if(backoff < 1024) {
+                backoff <<= 1;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void unlock() { locked.store(false, std::memory_order_release); }
+
+private:
+    alignas(64) std::atomic<bool> locked{ false };
+};
+
+// "Futexes Are Tricky", mutex #3: 0 unlocked, 1 locked, 2 locked with waiters
+class futex_mutex : public profiled_lock {
+public:
+    using profiled_lock::profiled_lock;
+
+    bool try_lock() {
+        int expected = 0;
+        return state.compare_exchange_strong(expected, 1, std::memory_order_acquire);
+    }
+
+    void lock() {
+        int c = 0;
+        if(state.compare_exchange_strong(c, 1, std::memory_order_acquire)) return;
+
+        if(c != 2) c = state.exchange(2, std::memory_order_acquire);
+        while(c != 0) {
+            wait(2);
+            c = state.exchange(2, std::memory_order_acquire);
+        }
+    }
+
+    void unlock() {
+        if(state.fetch_sub(1, std::memory_order_release) != 1) {
+            state.store(0, std::memory_order_release);
+            wake_one();
+        }
+    }
+
+private:
+#if defined(__linux__)
+    void wait(int expected) {
+        syscall(SYS_futex, reinterpret_cast<int*>(&state), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+    }
+
+    void wake_one() {
+        syscall(SYS_futex, reinterpret_cast<int*>(&state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+#else
+    // no futex: degrade to polling
+    void wait(int expected) {
+        while(state.load(std::memory_order_relaxed) == expected) std::this_thread::yield();
+    }
+
+    void wake_one() { }
+#endif
+
+    static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex word must be a plain int");
+    alignas(64) std::atomic<int> state{ 0 };
+};
+
+// FIFO: waiters back off in proportion to their distance from the head
+class ticket_lock : public profiled_lock {
+public:
+    using profiled_lock::profiled_lock;
+
+    bool try_lock() {
+        std::uint32_t serving = now_serving.load(std::memory_order_relaxed);
+        std::uint32_t expected = serving;
+        return next_ticket.compare_exchange_strong(expected, serving + 1, std::memory_order_acquire);
+    }
+
+    void lock() {
+        std::uint32_t ticket = next_ticket.fetch_add(1, std::memory_order_relaxed);
+
+        // FIFO handoff stalls if the next ticket holder is descheduled, so
+        // waiters yield after a short spin instead of burning their slice
+        for(unsigned rounds = 0;; ++rounds) {
+            std::uint32_t serving = now_serving.load(std::memory_order_acquire);
+            if(serving == ticket) return;
+
+            std::uint32_t distance = ticket - serving;
+            if(distance > 4 || rounds >= 16) {
+                std::this_thread::yield();
+            } else {
+                for(std::uint32_t i = 0; i < distance * 32; ++i) cpu_pause();
+            }
+        }
+    }
+
+    void unlock() {
+        now_serving.store(now_serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    alignas(64) std::atomic<std::uint32_t> next_ticket{ 0 };
+    alignas(64) std::atomic<std::uint32_t> now_serving{ 0 };
+};
+
+class rw_lock : public profiled_lock {
+public:
+    using profiled_lock::profiled_lock;
+
+    bool try_lock() { return mutex.try_lock(); }
+    void lock() { mutex.lock(); }
+    void unlock() { mutex.unlock(); }
+
+    bool try_lock_shared() { return mutex.try_lock_shared(); }
+    void lock_shared() { mutex.lock_shared(); }
+    void unlock_shared() { mutex.unlock_shared(); }
+
+private:
+    std::shared_mutex mutex;
+};
+
+// the read side of an rw_lock, shaped like the other policies
+struct shared_side {
+    rw_lock* rw;
+
+    bool try_lock() const { return rw->try_lock_shared(); }
+    void lock() const { rw->lock_shared(); }
+    void unlock() const { rw->unlock_shared(); }
+    lock_stats& stats() const { return rw->stats; }
+};
+
+template<typename Lock>
+struct exclusive_side {
+    Lock* lock_;
+
+    bool try_lock() const { return lock_->try_lock(); }
+    void lock() const { lock_->lock(); }
+    void unlock() const { lock_->unlock(); }
+    lock_stats& stats() const { return lock_->stats; }
+};
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+// takes the lock around func, timing the wait and the hold. The side only
+// points at the lock, so the decorated function can be called as const.
+template<typename Side, typename F>
+constexpr auto locked_with(Side side, const F& func) {
+    return [side, func](auto&&... args) -> decltype(auto) {
+        lock_stats& stats = side.stats();
+        std::uint64_t start = now_ns();
+
+        if(!side.try_lock()) {
+            stats.contended.fetch_add(1, std::memory_order_relaxed);
+            side.lock();
+        }
+
+        std::uint64_t acquired = now_ns();
+        stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+        stats.waited(acquired - start);
+
+        struct release {
+            const Side& side;
+            lock_stats& stats;
+            std::uint64_t acquired;
+
+            ~release() {
+                stats.hold_ns.fetch_add(now_ns() - acquired, std::memory_order_relaxed);
+                side.unlock();
+            }
+        } guard{ side, stats, acquired };
+
+        return func(std::forward<decltype(args)>(args)...);
+    };
+}
+
+template<typename Lock, typename F>
+constexpr auto synchronized(Lock& lock, const F& func) {
+    return locked_with(exclusive_side<Lock>{ &lock }, func);
+}
+
+template<typename F>
+constexpr auto synchronized_shared(rw_lock& lock, const F& func) {
+    return locked_with(shared_side{ &lock }, func);
+}
+
+///////////////////////////////////////////////
+// an example class with member functions    //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    // stateful: records a sale and returns the running total
+    double sell(int count) {
+        sold += count;
+        revenue += count*cost_per_apple;
+        return revenue;
+    }
+
+    double cost_per_apple;
+    long sold = 0;
+    double revenue = 0;
+};
+
+////////////////////////////////////
+//    visitor function            //
+////////////////////////////////////
+
+template<typename F>
+constexpr auto classmethod(F func) {
+    return [func](auto& a, auto&&... args) {
+        return (a.*func)(args...);
+    };
+}
+
+////////////////////////////////////
+// final decorated functions      //
+////////////////////////////////////
+
+spin_lock sell_spin("sell_spin");
+futex_mutex sell_futex("sell_futex");
+ticket_lock sell_ticket("sell_ticket");
+rw_lock stand_rw("stand_rw");
+
+const auto sell_spinning = synchronized(sell_spin, classmethod(&apples::sell));
+const auto sell_sleeping = synchronized(sell_futex, classmethod(&apples::sell));
+const auto sell_in_order = synchronized(sell_ticket, classmethod(&apples::sell));
+
+// readers and the writer share one rw_lock
+const auto get_cost = synchronized_shared(stand_rw, classmethod(&apples::calculate_cost));
+const auto sell_rw = synchronized(stand_rw, classmethod(&apples::sell));
+
+int main() {
+    const int per_thread = 100000;
+
+    auto bench = [](const char* label, const auto& f, std::size_t threads, long sold_per_thread) {
+        apples shared(1.09);
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for(std::size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&]() {
+                for(int i = 0; i < per_thread; ++i) {
+                    f(shared);
+                }
+            });
+        }
+        for(auto& w : workers) w.join();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << label << threads << " threads: " << threads * per_thread / seconds / 1e6 << " Mcalls/s"
+                  << (shared.sold == long(threads) * sold_per_thread ? "" : "  LOST UPDATES!") << std::endl;
+    };
+
+    std::size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t threads = std::max<std::size_t>(hw, 4);
+
+    bench("spin_lock   ", [](apples& a) { sell_spinning(a, 1); }, threads, per_thread);
+    bench("futex_mutex ", [](apples& a) { sell_sleeping(a, 1); }, threads, per_thread);
+    bench("ticket_lock ", [](apples& a) { sell_in_order(a, 1); }, threads, per_thread);
+
+    // ticket locks hand off in strict order, so they stall whenever the next
+    // waiter is not running: watch lock_wait_ns_total when threads > cores
+
+    // mostly reads with a write every 64 calls
+    bench("rw_lock     ", [](apples& a) {
+        static thread_local unsigned n = 0;
+        if(++n % 64 == 0) {
+            sell_rw(a, 64);
+        } else {
+            get_cost(a, 2, 1.1);
+        }
+    }, threads, per_thread / 64 * 64);
+
+    std::cout << std::endl;
+    metrics_registry::instance().print(std::cout);
+
+    return 0;
+}
@@ -0,0 +1,552 @@
+// allocation-free future/promise for async decorator results
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// A decorator that runs its call somewhere else and hands back a std::future
+// (see actor.cpp) pays for a heap-allocated, reference-counted shared state
+// per call, plus the locking inside it. task_result<T> is the same idea with
+// the storage owned by the caller:
+//
+//   task_result<double> cost;                  // on the caller's stack
+//   get_cost_async(cost, std::ref(groceries), 2, 1.1);
+//   std::cout << cost.get();
+//
+// The value (or exception_ptr) lives inside the task_result, and the
+// producer's task_promise is a pointer to it. Everything the two sides need
+// to agree on is one 32-bit atomic state word:
+//
+//   ready      the value or exception has been stored
+//   failed     it was an exception
+//   waiting    a thread is asleep on the word (futex wait)
+//   chained    a then() continuation has been attached
+//   ran        that continuation has finished
+//
+// The producer stores the result and sets ready with one fetch_or. A waiter
+// spins briefly if there is another core to wait for, then sleeps with
+// FUTEX_WAIT; the producer only makes the FUTEX_WAKE system call when the
+// waiting bit says someone is asleep.
+// then(f) stores f in a small inline buffer. Whichever side arrives second,
+// the producer completing or the consumer attaching, runs f right there.
+// If f throws, the exception is kept for continuation_error() and ran is
+// still set, so nobody waits on it forever.
+//
+// The caller must keep the task_result alive until the call completes; its
+// destructor waits for that. A task_promise dropped without a result stores
+// a broken_promise error, like std::promise.
+//
+//   g++ -std=c++17 -O2 -pthread task_result.cpp
+
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <exception>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <chrono>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(__linux__)
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+//////////////////////////////////////
+//   allocation counter             //
+//////////////////////////////////////
+
+// every operator new in the program, for the benchmark
+std::atomic<std::size_t> allocations{ 0 };
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+//////////////////////////////////////
+//   futex word                     //
+//////////////////////////////////////
+
+#if defined(__linux__)
+inline void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected) {
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+// private futexes are keyed by address only, so waking a word whose owner
+// has just been destroyed is harmless
+inline void futex_wake_all(std::atomic<std::uint32_t>& word) {
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+}
+#else
+// no futex: degrade to polling
+inline void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected) {
+    while(word.load(std::memory_order_relaxed) == expected) std::this_thread::yield();
+}
+
+inline void futex_wake_all(std::atomic<std::uint32_t>&) { }
+#endif
+
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t), "futex word must be a plain int");
+
+//////////////////////////////////////
+//   task_result and task_promise   //
+//////////////////////////////////////
+
+template<typename T>
+class task_promise;
+
+template<typename T>
+class task_result {
+public:
+    static constexpr std::size_t continuation_bytes = 48;
+
+    task_result() = default;
+    task_result(const task_result&) = delete;
+    task_result& operator=(const task_result&) = delete;
+
+    ~task_result() {
+        if(promised) {
+            std::uint32_t s = wait_for(ready);
+            if(s & chained) wait_for(ran);
+        }
+
+        std::uint32_t s = state.load(std::memory_order_acquire);
+        if((s & ready) && !(s & failed)) value_ptr()->~T();
+        if(destroy_continuation) destroy_continuation(continuation);
+    }
+
+    // one promise per task_result
+    task_promise<T> get_promise() {
+        promised = true;
+        return task_promise<T>(this);
+    }
+
+    bool is_ready() const { return state.load(std::memory_order_acquire) & ready; }
+
+    void wait() const { wait_for(ready); }
+
+    // the value, or rethrows what the call threw
+    T& get() {
+        if(wait_for(ready) & failed) std::rethrow_exception(error);
+        return *value_ptr();
+    }
+
+    // f(task_result&) runs once, on whichever thread completes the pair:
+    // the producer if it finishes later, otherwise this thread, now
+    template<typename F>
+    void then(F f) {
+        static_assert(sizeof(F) <= continuation_bytes && alignof(F) <= alignof(std::max_align_t),
+                      "continuation does not fit task_result's inline buffer");
+
+        ::new(static_cast<void*>(continuation)) F(std::move(f));
+        run_continuation = [](void* p, task_result& r) { (*static_cast<F*>(p))(r); };
+        destroy_continuation = [](void* p) { static_cast<F*>(p)->~F(); };
+
+        if(state.fetch_or(chained, std::memory_order_acq_rel) & ready) {
+            finish_continuation();
+        }
+    }
+
+    // what the then() continuation threw, once it has run; null if it
+    // returned or none was attached. It may have run on the worker, so it
+    // cannot simply propagate.
+    std::exception_ptr continuation_error() const {
+        if(!(state.load(std::memory_order_acquire) & chained)) return nullptr;
+        wait_for(ran);
+        return continuation_failure;
+    }
+
+private:
+    friend class task_promise<T>;
+
+    enum : std::uint32_t { ready = 1, failed = 2, waiting = 4, chained = 8, ran = 16 };
+
+    T* value_ptr() { return std::launder(reinterpret_cast<T*>(storage)); }
+
+    // returns the state once every bit in mask is set
+    std::uint32_t wait_for(std::uint32_t mask) const {
+        // spinning only helps when the producer is running on another core
+        static const int spins = std::thread::hardware_concurrency() > 1 ? 128 : 0;
+
+        for(int spin = 0; spin < spins; ++spin) {
+            std::uint32_t s = state.load(std::memory_order_acquire);
+            if((s & mask) == mask) return s;
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+
+        std::uint32_t s = state.load(std::memory_order_acquire);
+        while((s & mask) != mask) {
+            if(!(s & waiting)) {
+                if(!state.compare_exchange_weak(s, s | waiting, std::memory_order_acquire)) continue;
+                s |= waiting;
+            }
+
+            futex_wait(state, s);
+            s = state.load(std::memory_order_acquire);
+        }
+        return s;
+    }
+
+    template<typename... Args>
+    void set_value(Args&&... args) {
+        ::new(static_cast<void*>(storage)) T(std::forward<Args>(args)...);
+        complete(ready);
+    }
+
+    void set_exception(std::exception_ptr e) {
+        error = std::move(e);
+        complete(ready | failed);
+    }
+
+    void complete(std::uint32_t bits) {
+        std::uint32_t s = state.fetch_or(bits, std::memory_order_acq_rel);
+        if(s & chained) {
+            finish_continuation();
+        } else if(s & waiting) {
+            futex_wake_all(state);
+        }
+    }
+
+    // sets ran and wakes the waiters however the continuation leaves
+    void finish_continuation() {
+        struct mark_ran {
+            task_result* r;
+            ~mark_ran() {
+                if(r->state.fetch_or(ran, std::memory_order_acq_rel) & waiting) futex_wake_all(r->state);
+            }
+        } guard{ this };
+
+        try {
+            run_continuation(continuation, *this);
+        } catch(...) {
+            continuation_failure = std::current_exception();
+        }
+    }
+
+    mutable std::atomic<std::uint32_t> state{ 0 };
+    bool promised = false;
+    alignas(T) unsigned char storage[sizeof(T)];
+    std::exception_ptr error;
+    std::exception_ptr continuation_failure;
+
+    void (*run_continuation)(void*, task_result&) = nullptr;
+    void (*destroy_continuation)(void*) = nullptr;
+    alignas(std::max_align_t) unsigned char continuation[continuation_bytes];
+};
+
+template<typename T>
+class task_promise {
+public:
+    task_promise(task_promise&& other) noexcept : target(std::exchange(other.target, nullptr)) { }
+    task_promise(const task_promise&) = delete;
+    task_promise& operator=(const task_promise&) = delete;
+    task_promise& operator=(task_promise&&) = delete;
+
+    ~task_promise() {
+        if(target) {
+            set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+        }
+    }
+
+    template<typename... Args>
+    void set_value(Args&&... args) {
+        // cleared only once stored: if T's constructor throws, the promise
+        // is still live and run() or the destructor stores the exception
+        target->set_value(std::forward<Args>(args)...);
+        target = nullptr;
+    }
+
+    void set_exception(std::exception_ptr e) {
+        target->set_exception(std::move(e));
+        target = nullptr;
+    }
+
+    // stores func(args...) or whatever it throws
+    template<typename F, typename... Args>
+    void run(F& func, Args&... args) {
+        try {
+            set_value(func(args...));
+        } catch(...) {
+            if(target) set_exception(std::current_exception());
+        }
+    }
+
+private:
+    friend class task_result<T>;
+
+    explicit task_promise(task_result<T>* target) : target(target) { }
+
+    task_result<T>* target;
+};
+
+//////////////////////////////////////
+//   a small executor               //
+//////////////////////////////////////
+
+// one worker thread draining a single-producer ring of jobs. Jobs are
+// stored inline, so submitting does not allocate either. An idle worker
+// sleeps on a futex; submit() only makes the wake call when it is asleep.
+class worker {
+public:
+    worker() : thread([this]() { run(); }) { }
+
+    ~worker() {
+        stopping.store(true, std::memory_order_release);
+        wake();
+        thread.join();
+    }
+
+    // from one thread at a time
+    template<typename J>
+    void submit(J job) {
+        static_assert(sizeof(J) <= job_bytes && alignof(J) <= alignof(std::max_align_t), "job does not fit a slot");
+
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        while(t - head.load(std::memory_order_acquire) == capacity) std::this_thread::yield();
+
+        slot& s = slots[t % capacity];
+        ::new(static_cast<void*>(s.storage)) J(std::move(job));
+        s.run = [](void* p) {
+            J* j = static_cast<J*>(p);
+            (*j)();
+            j->~J();
+        };
+        tail.store(t + 1, std::memory_order_release);
+        wake();
+    }
+
+private:
+    static constexpr std::size_t capacity = 256;
+    static constexpr std::size_t job_bytes = 96;
+
+    struct slot {
+        void (*run)(void*);
+        alignas(std::max_align_t) unsigned char storage[job_bytes];
+    };
+
+    // pairs with park(): either the worker sees the new tail or we see parked
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(parked.load(std::memory_order_relaxed)) {
+            parked.store(0, std::memory_order_relaxed);
+            futex_wake_all(parked);
+        }
+    }
+
+    void park(std::size_t h) {
+        parked.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(h == tail.load(std::memory_order_acquire) && !stopping.load(std::memory_order_acquire)) {
+            futex_wait(parked, 1);
+        }
+        parked.store(0, std::memory_order_relaxed);
+    }
+
+    void run() {
+        int idle = 0;
+        for(;;) {
+            std::size_t h = head.load(std::memory_order_relaxed);
+            if(h == tail.load(std::memory_order_acquire)) {
+                if(stopping.load(std::memory_order_acquire) && h == tail.load(std::memory_order_acquire)) return;
+
+                // a few yields catch back-to-back submits, then sleep
+                if(++idle < 64) {
+                    std::this_thread::yield();
+                } else {
+                    park(h);
+                    idle = 0;
+                }
+                continue;
+            }
+
+            idle = 0;
+            slot& s = slots[h % capacity];
+            s.run(s.storage);
+            head.store(h + 1, std::memory_order_release);
+        }
+    }
+
+    slot slots[capacity];
+    alignas(64) std::atomic<std::size_t> head{ 0 };
+    alignas(64) std::atomic<std::size_t> tail{ 0 };
+    std::atomic<bool> stopping{ false };
+    std::atomic<std::uint32_t> parked{ 0 };
+    std::thread thread;
+};
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+// runs func(args...) on the worker and completes `result`, which the
+// caller owns. Arguments are copied like std::async; use std::ref to share.
+template<typename F>
+constexpr auto async_call(worker& w, const F& func) {
+    return [w = &w, func](auto& result, auto&&... args) {
+        auto call = [func, promise = result.get_promise(),
+                     params = std::make_tuple(std::decay_t<decltype(args)>(args)...)]() mutable {
+            std::apply([&](auto&... p) { promise.run(func, p...); }, params);
+        };
+
+        w->submit(std::move(call));
+    };
+}
+
+// the same decorator on std::promise and std::future, for the benchmark
+template<typename F>
+constexpr auto future_call(worker& w, const F& func) {
+    return [w = &w, func](auto&&... args) {
+        using R = decltype(func(std::decay_t<decltype(args)>(args)...));
+
+        std::promise<R> promise;
+        std::future<R> result = promise.get_future();
+
+        auto call = [func, promise = std::move(promise),
+                     params = std::make_tuple(std::decay_t<decltype(args)>(args)...)]() mutable {
+            std::apply([&](auto&... p) {
+                try {
+                    promise.set_value(func(p...));
+                } catch(...) {
+                    promise.set_exception(std::current_exception());
+                }
+            }, params);
+        };
+
+        w->submit(std::move(call));
+        return result;
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    double cost_per_apple;
+};
+
+////////////////////////////////////
+//    visitor function            //
+////////////////////////////////////
+
+template<typename F>
+constexpr auto visit_apples(const F& func) {
+    return [func](apples& a, auto&&... args) {
+        return (a.*func)(std::forward<decltype(args)>(args)...);
+    };
+}
+
+///////////////////////////////
+// final decorated functions //
+///////////////////////////////
+
+worker pricing;
+
+const auto get_cost_async = async_call(pricing, visit_apples(&apples::calculate_cost));
+const auto get_cost_future = future_call(pricing, visit_apples(&apples::calculate_cost));
+
+int main() {
+    apples groceries(1.09);
+
+    task_result<double> good, bad;
+    get_cost_async(good, std::ref(groceries), 2, 1.1);
+    get_cost_async(bad, std::ref(groceries), 0, 1.1);
+
+    std::cout << "Bag cost $" << good.get() << std::endl;
+    try {
+        bad.get();
+    } catch(std::exception& e) {
+        std::cout << "There was an error: " << e.what() << std::endl;
+    }
+
+    // a continuation runs on the worker, or here if the result is already in
+    double total = 0;
+    {
+        task_result<double> chained;
+        chained.then([&total](task_result<double>& r) { total += r.get(); });
+        get_cost_async(chained, std::ref(groceries), 5, 1.3);
+    }
+    std::cout << "then() added $" << total << std::endl;
+
+    // a continuation that throws, here because the call failed
+    {
+        task_result<double> chained;
+        chained.then([&total](task_result<double>& r) { total += r.get(); });
+        get_cost_async(chained, std::ref(groceries), 0, 1.3);
+
+        try {
+            if(auto e = chained.continuation_error()) std::rethrow_exception(e);
+        } catch(std::exception& e) {
+            std::cout << "then() threw: " << e.what() << "\n" << std::endl;
+        }
+    }
+
+    auto bench = [&](const char* label, auto&& one_call) {
+        const int calls = 100000;
+        double sum = 0;
+
+        std::size_t before = allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < calls; ++i) {
+            sum += one_call(1 + (i & 7));
+        }
+        auto end = std::chrono::steady_clock::now();
+        std::size_t allocated = allocations.load() - before;
+
+        std::cout << label << std::chrono::duration<double, std::nano>(end - start).count() / calls
+                  << " ns/call, " << double(allocated) / calls << " allocations/call (checksum " << sum << ")" << std::endl;
+    };
+
+    // completed on the calling thread: the cost of the shared state alone
+    bench("same thread, std::promise: ", [](int count) {
+        std::promise<double> p;
+        std::future<double> f = p.get_future();
+        p.set_value(count * 1.1);
+        return f.get();
+    });
+    bench("same thread, task_result:  ", [](int count) {
+        task_result<double> r;
+        r.get_promise().set_value(count * 1.1);
+        return r.get();
+    });
+
+    // a round trip through the worker thread
+    bench("round trip, std::future:   ", [&](int count) {
+        return get_cost_future(std::ref(groceries), count, 1.1).get();
+    });
+    bench("round trip, task_result:   ", [&](int count) {
+        task_result<double> r;
+        get_cost_async(r, std::ref(groceries), count, 1.1);
+        return r.get();
+    });
+
+    return 0;
+}
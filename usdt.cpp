@@ -0,0 +1,334 @@
+// USDT probes in decorators
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// Every decorator below carries static tracepoints at entry, exit and error
+// that bpftrace, perf or SystemTap can attach to in a running binary:
+//
+//   bpftrace -e 'usdt:./usdt:decorators:fail_safe_error { printf("%s\n", str(arg1)); }'
+//
+// A probe site is a single nop plus an ELF note describing where its
+// arguments live, so an unattached probe costs nothing. Each probe also has
+// a semaphore that tracers increment on attach; work done only to feed a
+// probe (timestamps, hashing, string conversion) is skipped while it is zero.
+//
+// The probe macros below emit the same .note.stapsdt layout as SystemTap's
+// <sys/sdt.h> (x86-64 only, up to three arguments) so the demo does not
+// depend on systemtap-sdt-dev. Build with -DDECORATORS_USDT=0 to remove them.
+//
+//   g++ -std=c++17 -O2 usdt.cpp -o usdt && readelf -n usdt
+
+#include <iostream>
+#include <memory>
+#include <map>
+#include <tuple>
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+
+using namespace std;
+
+//////////////////////////////////////
+//   sys/sdt.h compatible probes    //
+//////////////////////////////////////
+
+#ifndef DECORATORS_USDT
+    #if defined(__x86_64__) && defined(__linux__)
+        #define DECORATORS_USDT 1
+    #else
+        #define DECORATORS_USDT 0
+    #endif
+#endif
+
+#if DECORATORS_USDT
+
+// operand size as systemtap wants it: negative for signed types
+template<typename T>
+constexpr int probe_arg_size() {
+    using U = std::decay_t<T>;
+    return std::is_signed<U>::value ? -int(sizeof(U)) : int(sizeof(U));
+}
+
+#define PROBE_NOTE_BEGIN(provider, name)                                   \
+    "990: nop\n"                                                           \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                          \
+    ".balign 4\n"                                                          \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                     \
+    "991: .asciz \"stapsdt\"\n"                                            \
+    "992: .balign 4\n"                                                     \
+    "993: .8byte 990b\n"                                                   \
+    ".8byte _.stapsdt.base\n"                                              \
+    ".8byte " #provider "_" #name "_semaphore\n"                           \
+    ".asciz \"" #provider "\"\n"                                           \
+    ".asciz \"" #name "\"\n"
+
+#define PROBE_NOTE_END                                                     \
+    "994: .balign 4\n"                                                     \
+    ".popsection\n"                                                        \
+    ".ifndef _.stapsdt.base\n"                                             \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"\
+    ".weak _.stapsdt.base\n"                                               \
+    ".hidden _.stapsdt.base\n"                                             \
+    "_.stapsdt.base: .space 1\n"                                           \
+    ".size _.stapsdt.base, 1\n"                                            \
+    ".popsection\n"                                                        \
+    ".endif\n"
+
+// tracers bump the semaphore when they attach to provider:name
+#define PROBE_SEMAPHORE(provider, name)                                    \
+    extern "C" {                                                           \
+        __attribute__((section(".probes"), used))                          \
+        volatile unsigned short provider##_##name##_semaphore = 0;         \
+    }                                                                      \
+    static_assert(true, "")
+
+#define PROBE_ENABLED(provider, name) (__builtin_expect(provider##_##name##_semaphore != 0, 0))
+
+#define PROBE1(provider, name, a1)                                         \
+    __asm__ __volatile__(PROBE_NOTE_BEGIN(provider, name)                  \
+        ".asciz \"%c[size1]@%[arg1]\"\n"                                        \
+        PROBE_NOTE_END                                                     \
+        :: [size1] "n"(probe_arg_size<decltype(a1)>()), [arg1] "nor"(a1))
+
+#define PROBE2(provider, name, a1, a2)                                     \
+    __asm__ __volatile__(PROBE_NOTE_BEGIN(provider, name)                  \
+        ".asciz \"%c[size1]@%[arg1] %c[size2]@%[arg2]\"\n"                           \
+        PROBE_NOTE_END                                                     \
+        :: [size1] "n"(probe_arg_size<decltype(a1)>()), [arg1] "nor"(a1),      \
+           [size2] "n"(probe_arg_size<decltype(a2)>()), [arg2] "nor"(a2))
+
+#define PROBE3(provider, name, a1, a2, a3)                                 \
+    __asm__ __volatile__(PROBE_NOTE_BEGIN(provider, name)                  \
+        ".asciz \"%c[size1]@%[arg1] %c[size2]@%[arg2] %c[size3]@%[arg3]\"\n"              \
+        PROBE_NOTE_END                                                     \
+        :: [size1] "n"(probe_arg_size<decltype(a1)>()), [arg1] "nor"(a1),      \
+           [size2] "n"(probe_arg_size<decltype(a2)>()), [arg2] "nor"(a2),      \
+           [size3] "n"(probe_arg_size<decltype(a3)>()), [arg3] "nor"(a3))
+
+#else
+
+#define PROBE_SEMAPHORE(provider, name) static_assert(true, "")
+#define PROBE_ENABLED(provider, name) (false)
+// the arguments are still consumed so this build stays warning-free
+#define PROBE1(provider, name, a1) ((void)(a1))
+#define PROBE2(provider, name, a1, a2) ((void)(a1), (void)(a2))
+#define PROBE3(provider, name, a1, a2, a3) ((void)(a1), (void)(a2), (void)(a3))
+
+#endif
+
+// one semaphore per probe point
+PROBE_SEMAPHORE(decorators, log_time_entry);
+PROBE_SEMAPHORE(decorators, log_time_exit);
+PROBE_SEMAPHORE(decorators, fail_safe_entry);
+PROBE_SEMAPHORE(decorators, fail_safe_error);
+PROBE_SEMAPHORE(decorators, output_exit);
+PROBE_SEMAPHORE(decorators, memoize_hit);
+PROBE_SEMAPHORE(decorators, memoize_miss);
+
+// identifies a decorated layer in probe arguments
+template<typename F>
+std::uintptr_t probe_id(const F& func) {
+    return reinterpret_cast<std::uintptr_t>(&func);
+}
+
+inline std::int64_t probe_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+///////////////////////////////////
+// weak optional value structure //
+///////////////////////////////////
+template<typename T>
+struct optional_type {
+    T value;
+    bool OK;
+    bool BAD;
+    std::string msg;
+
+    optional_type(T&& t) : value(std::move(t)) { OK = true; BAD = false; }
+    optional_type(bool ok, std::string msg="") : msg(std::move(msg)) { OK = ok; BAD = !ok; }
+};
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+// probes: fail_safe_entry(id), fail_safe_error(id, message)
+template<typename F>
+constexpr auto exception_fail_safe(const F& func) {
+    return [func](auto&&... args)
+    -> optional_type<decltype(func(std::forward<decltype(args)>(args)...))> {
+        using R = optional_type<decltype(func(std::forward<decltype(args)>(args)...))>;
+
+        PROBE1(decorators, fail_safe_entry, probe_id(func));
+
+        try {
+            return R(func(std::forward<decltype(args)>(args)...));
+        } catch(std::exception& e) {
+            PROBE2(decorators, fail_safe_error, probe_id(func), e.what());
+            return R(false, e.what());
+        } catch(...) {
+            const char* what = "Exception caught: default exception";
+            PROBE2(decorators, fail_safe_error, probe_id(func), what);
+            return R(false, std::string(what));
+        }
+    };
+}
+
+// probes: output_exit(id, ok)
+template<typename F>
+constexpr auto output(const F& func) {
+    return [func](auto&&... args) {
+        auto opt = func(std::forward<decltype(args)>(args)...);
+
+        if(opt.BAD) {
+            std::cout << "There was an error: " << opt.msg << std::endl;
+        } else {
+            std::cout << "Bag cost $" << opt.value << std::endl;
+        }
+
+        PROBE2(decorators, output_exit, probe_id(func), opt.OK);
+        return opt;
+    };
+}
+
+// probes: log_time_entry(id), log_time_exit(id, elapsed ns)
+// the elapsed time is only measured while someone listens on log_time_exit
+template<typename F>
+constexpr auto log_time(const F& func) {
+    return [func](auto&&... args) {
+        PROBE1(decorators, log_time_entry, probe_id(func));
+        std::int64_t start = PROBE_ENABLED(decorators, log_time_exit) ? probe_now_ns() : 0;
+
+        auto now = std::chrono::system_clock::now();
+        std::time_t time = std::chrono::system_clock::to_time_t(now);
+        auto opt = func(std::forward<decltype(args)>(args)...);
+        std::cout << "> Logged at " << std::ctime(&time) << std::endl;
+
+        // a tracer that attached mid-call has no start time to measure from
+        if(start != 0 && PROBE_ENABLED(decorators, log_time_exit)) {
+            std::int64_t elapsed = probe_now_ns() - start;
+            PROBE2(decorators, log_time_exit, probe_id(func), elapsed);
+        }
+
+        return opt;
+    };
+}
+
+// probes: memoize_hit(id, key hash), memoize_miss(id, key hash)
+// the key is only hashed for a probe that is being listened to
+template<typename... Args>
+std::size_t probe_key_hash(const Args&... args) {
+    std::size_t seed = 0;
+    (void)std::initializer_list<int>{
+        (seed ^= std::hash<Args>()(args) + 0x9e3779b9 + (seed << 6) + (seed >> 2), 0)...
+    };
+    return seed;
+}
+
+template<typename F>
+auto memoize(const F& func) {
+    auto cache = std::make_shared<std::map<std::tuple<int, double>, double>>();
+
+    return [func, cache](int count, double weight) {
+        auto key = std::make_tuple(count, weight);
+        auto it = cache->find(key);
+
+        if(it != cache->end()) {
+            if(PROBE_ENABLED(decorators, memoize_hit)) {
+                std::size_t h = probe_key_hash(count, weight);
+                PROBE2(decorators, memoize_hit, probe_id(func), h);
+            }
+            return it->second;
+        }
+
+        if(PROBE_ENABLED(decorators, memoize_miss)) {
+            std::size_t h = probe_key_hash(count, weight);
+            PROBE2(decorators, memoize_miss, probe_id(func), h);
+        }
+
+        double result = func(count, weight);
+        cache->emplace(key, result);
+        return result;
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    double cost_per_apple;
+};
+
+////////////////////////////////////
+//    visitor function            //
+////////////////////////////////////
+
+template<typename F>
+constexpr auto visit_apples(const F& func) {
+    return [func](apples& a, auto&&... args) {
+        return (a.*func)(std::forward<decltype(args)>(args)...);
+    };
+}
+
+////////////////////////////////////
+// final decorated functions      //
+////////////////////////////////////
+
+constexpr auto get_cost = log_time(output(exception_fail_safe(visit_apples(&apples::calculate_cost))));
+
+apples market(1.09);
+auto price = memoize([](int count, double weight) { return market.calculate_cost(count, weight); });
+
+int main() {
+    apples groceries1(1.09), groceries2(3.0);
+
+    get_cost(groceries2, 2, 1.1);
+    get_cost(groceries1, 4, 0);
+
+    // rough per-call cost of the probes on a hot path
+    auto bench = [](const char* label) {
+        const int calls = 10000000;
+        double sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < calls; ++i) {
+            sum += price(1 + (i & 7), 1.1);
+        }
+        auto end = std::chrono::steady_clock::now();
+        std::cout << label << std::chrono::duration<double, std::nano>(end - start).count() / calls
+                  << " ns/call (checksum " << sum << ")" << std::endl;
+    };
+
+#if DECORATORS_USDT
+    bench("memoize, probes idle:        ");
+
+    // what an attached tracer does to the semaphore; the probe itself stays
+    // a nop here since no uprobe is installed, so this isolates the
+    // marshalling cost the semaphore guards
+    decorators_memoize_hit_semaphore = 1;
+    bench("memoize, semaphore raised:   ");
+    decorators_memoize_hit_semaphore = 0;
+#else
+    bench("memoize, probes compiled out: ");
+#endif
+
+    return 0;
+}
@@ -0,0 +1,334 @@
+// stall watchdog for decorated calls
+// view the full tutorial at https://github.com/TheMaverickProgrammer/C-Python-like-Decorators
+//
+// watchdog(threshold, func, name) notices calls that hang. Each thread owns
+// one slot in a global table. On entry a call stores one packed word in its
+// slot: the start time in milliseconds plus a small id for the decorated
+// function. On exit it stores the previous word back. Those two relaxed
+// stores are all the hot path does; there are no locks, fences or
+// read-modify-writes.
+//
+// A single watchdog_monitor thread wakes up periodically and scans the
+// slots. When a call has been running longer than its function's threshold,
+// it reports the function name, the thread and the elapsed time, once per
+// stuck call.
+//
+// The start time comes from CLOCK_MONOTONIC_COARSE where available, which is
+// cheaper than the precise clock and plenty for millisecond thresholds. While
+// a nested watched call runs, it hides its caller; the caller becomes visible
+// again when the nested call returns.
+//
+//   g++ -std=c++17 -O2 -pthread watchdog.cpp
+
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <functional>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+#include <cstdint>
+#include <time.h>
+
+using namespace std;
+
+//////////////////////////////////////
+//   call slots                     //
+//////////////////////////////////////
+
+constexpr unsigned site_bits = 20;
+constexpr std::uint64_t site_mask = (std::uint64_t(1) << site_bits) - 1;
+constexpr std::size_t max_watched_threads = 256;
+
+// monotonic milliseconds; the 44 bits left next to the site id last for centuries
+inline std::uint64_t watchdog_now_ms() {
+#if defined(CLOCK_MONOTONIC_COARSE)
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return std::uint64_t(ts.tv_sec) * 1000u + std::uint64_t(ts.tv_nsec) / 1000000u;
+#else
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct watch_site {
+    std::string name;
+    std::uint64_t threshold_ms;
+};
+
+struct watchdog_table {
+    static watchdog_table& instance() {
+        static watchdog_table table;
+        return table;
+    }
+
+    // site ids start at 1 so a zero word means "no call"
+    std::uint64_t add_site(std::string name, std::uint64_t threshold_ms) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(sites.size() == site_mask) {
+            throw std::length_error("too many watchdog sites");
+        }
+
+        sites.push_back(watch_site{ std::move(name), threshold_ms });
+        return sites.size();
+    }
+
+    watch_site site(std::uint64_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return sites[id - 1];
+    }
+
+    // a thread without a slot (more than max_watched_threads) is not watched
+    std::size_t acquire_slot() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(std::size_t i = 0; i < max_watched_threads; ++i) {
+            if(!slot_used[i]) {
+                slot_used[i] = true;
+                std::ostringstream id;
+                id << std::this_thread::get_id();
+                thread_names[i] = id.str();
+                return i;
+            }
+        }
+        return max_watched_threads;
+    }
+
+    void release_slot(std::size_t i) {
+        std::lock_guard<std::mutex> lock(mutex);
+        slots[i].word.store(0, std::memory_order_relaxed);
+        slot_used[i] = false;
+    }
+
+    std::string thread_name(std::size_t i) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return thread_names[i];
+    }
+
+    struct alignas(64) slot {
+        std::atomic<std::uint64_t> word{ 0 };
+    };
+
+    slot slots[max_watched_threads];
+
+private:
+    std::mutex mutex;
+    std::vector<watch_site> sites;
+    bool slot_used[max_watched_threads] = {};
+    std::string thread_names[max_watched_threads];
+};
+
+inline std::atomic<std::uint64_t>* this_thread_slot() {
+    thread_local struct holder {
+        std::size_t index = watchdog_table::instance().acquire_slot();
+        ~holder() {
+            if(index != max_watched_threads) watchdog_table::instance().release_slot(index);
+        }
+    } slot;
+
+    if(slot.index == max_watched_threads) return nullptr;
+    return &watchdog_table::instance().slots[slot.index].word;
+}
+
+//////////////////////////////////////
+//   monitor thread                 //
+//////////////////////////////////////
+
+struct stall_report {
+    std::string function;
+    std::string thread;
+    std::uint64_t elapsed_ms;
+};
+
+class watchdog_monitor {
+public:
+    using reporter = std::function<void(const stall_report&)>;
+
+    explicit watchdog_monitor(std::chrono::milliseconds interval, reporter report = print_report)
+        : interval(interval), report(std::move(report)), thread([this]() { run(); }) { }
+
+    ~watchdog_monitor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+
+    static void print_report(const stall_report& r) {
+        std::cerr << "watchdog: " << r.function << " has been running for " << r.elapsed_ms
+                  << "ms on thread " << r.thread << std::endl;
+    }
+
+private:
+    void run() {
+        // the word last reported for each slot, so a stuck call is reported once
+        std::vector<std::uint64_t> reported(max_watched_threads, 0);
+        auto& table = watchdog_table::instance();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while(!wake.wait_for(lock, interval, [this]() { return stopping; })) {
+            std::uint64_t now = watchdog_now_ms();
+
+            for(std::size_t i = 0; i < max_watched_threads; ++i) {
+                std::uint64_t word = table.slots[i].word.load(std::memory_order_relaxed);
+                if(word == 0 || word == reported[i]) continue;
+
+                std::uint64_t start = word >> site_bits;
+                watch_site site = table.site(word & site_mask);
+                std::uint64_t elapsed = now > start ? now - start : 0;
+
+                if(elapsed > site.threshold_ms) {
+                    reported[i] = word;
+                    report(stall_report{ site.name, table.thread_name(i), elapsed });
+                }
+            }
+        }
+    }
+
+    std::chrono::milliseconds interval;
+    reporter report;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread thread;
+};
+
+////////////////////////////////////
+//     decorators                 //
+////////////////////////////////////
+
+template<typename F>
+auto watchdog(std::chrono::milliseconds threshold, const F& func, const char* name = "anonymous") {
+    std::uint64_t site = watchdog_table::instance().add_site(name, std::uint64_t(threshold.count()));
+
+    return [site, func](auto&&... args) -> decltype(auto) {
+        struct watched {
+            std::atomic<std::uint64_t>* slot = this_thread_slot();
+            std::uint64_t previous = 0;
+
+            explicit watched(std::uint64_t site) {
+                if(!slot) return;
+                previous = slot->load(std::memory_order_relaxed);
+                slot->store(watchdog_now_ms() << site_bits | site, std::memory_order_relaxed);
+            }
+
+            ~watched() {
+                if(slot) slot->store(previous, std::memory_order_relaxed);
+            }
+        } w(site);
+
+        return func(std::forward<decltype(args)>(args)...);
+    };
+}
+
+///////////////////////////////////////////////
+// an example class with a member function   //
+///////////////////////////////////////////////
+struct apples {
+    // ctor
+    apples(double cost_per_apple) : cost_per_apple(cost_per_apple) { }
+
+    // member function that throws
+    double calculate_cost(int count, double weight) {
+        if(count <= 0)
+            throw std::runtime_error("must have 1 or more apples");
+
+        if(weight <= 0)
+            throw std::runtime_error("apples must weigh more than 0 ounces");
+
+        return count*weight*cost_per_apple;
+    }
+
+    double cost_per_apple;
+};
+
+////////////////////////////////////
+//    visitor function            //
+////////////////////////////////////
+
+template<typename F>
+constexpr auto visit_apples(F func) {
+    return [func](apples& a, int count, double weight) {
+        return (a.*func)(count, weight);
+    };
+}
+
+//////////////////////////////
+// function implementations //
+//////////////////////////////
+
+std::mutex scale_mutex;
+
+// weighs on a shared scale; hangs for as long as someone else holds it
+double weigh_impl(int count) {
+    std::lock_guard<std::mutex> lock(scale_mutex);
+    return count * 1.1;
+}
+
+double slow_supplier_impl(apples& a) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    return a.cost_per_apple;
+}
+
+///////////////////////////////
+// final decorated functions //
+///////////////////////////////
+
+const auto get_cost = watchdog(std::chrono::milliseconds(50), visit_apples(&apples::calculate_cost), "get_cost");
+const auto weigh = watchdog(std::chrono::milliseconds(100), weigh_impl, "weigh");
+const auto ask_supplier = watchdog(std::chrono::milliseconds(100), slow_supplier_impl, "ask_supplier");
+
+int main() {
+    watchdog_monitor monitor(std::chrono::milliseconds(20));
+    apples groceries(1.09);
+
+    std::cout << "Bag cost $" << get_cost(groceries, 2, 1.1) << std::endl;
+    try {
+        get_cost(groceries, 0, 1.1);
+    } catch(std::exception& e) {
+        std::cout << "There was an error: " << e.what() << std::endl;
+    }
+
+    // one call stuck behind a lock, one waiting on a slow supplier
+    std::unique_lock<std::mutex> hold(scale_mutex);
+    std::thread stuck([]() {
+        double oz = weigh(3);
+        std::cout << "weighed " << oz << "oz" << std::endl;
+    });
+    std::thread slow([&groceries]() {
+        double price = ask_supplier(groceries);
+        std::cout << "supplier price $" << price << std::endl;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(400));
+    hold.unlock();
+    stuck.join();
+    slow.join();
+
+    // the hot path: two relaxed stores and a coarse clock read
+    const auto plain = visit_apples(&apples::calculate_cost);
+    auto bench = [&](const char* label, const auto& f) {
+        const int calls = 10000000;
+        double sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < calls; ++i) {
+            sum += f(groceries, 1 + (i & 7), 1.1);
+        }
+        auto end = std::chrono::steady_clock::now();
+        std::cout << label << std::chrono::duration<double, std::nano>(end - start).count() / calls
+                  << " ns/call (checksum " << sum << ")" << std::endl;
+    };
+
+    std::cout << std::endl;
+    bench("plain:    ", plain);
+    bench("watchdog: ", get_cost);
+
+    return 0;
+}